@@ -0,0 +1,212 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+#include "gsf_filter.h"
+
+
+/*  All allocations are rounded up to this so that everything handed out stays aligned for doubles.  */
+
+#define ARENA_ALIGN     16
+
+
+/*  We're out of memory.  Say so and either give up or, if the caller asked for it, jump back to the caller.  */
+
+static void arena_fail (ARENA *arena, char *what)
+{
+  perror (what);
+
+  if (arena->fail != NULL) longjmp (*arena->fail, 1);
+
+  exit (-1);
+}
+
+
+
+void *arena_alloc (ARENA *arena, size_t bytes)
+{
+  void *ptr;
+  uint8_t **overflow;
+  size_t new_size;
+
+
+  bytes = (bytes + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1);
+
+
+  /*  If the current block is full, put it on the overflow list and start a new one.  The overflow blocks stay
+      valid (pointers into them are still in use) until the next reset.  */
+
+  if (arena->used + bytes > arena->size)
+    {
+      if (arena->block != NULL)
+        {
+          overflow = (uint8_t **) realloc (arena->overflow, (arena->overflow_count + 1) * sizeof (uint8_t *));
+          if (overflow == NULL) arena_fail (arena, "Allocating arena overflow memory");
+          arena->overflow = overflow;
+          arena->overflow[arena->overflow_count] = arena->block;
+          arena->overflow_count++;
+        }
+
+      new_size = arena->size * 2;
+      if (new_size < bytes) new_size = bytes;
+      if (new_size < 1048576) new_size = 1048576;
+
+      /*  If this fails the old block is already on the overflow list, so leave the arena empty.  The next reset
+          frees the overflow blocks and tries again with one block.  */
+
+      arena->block = (uint8_t *) malloc (new_size);
+      if (arena->block == NULL)
+        {
+          arena->size = arena->used = 0;
+          arena_fail (arena, "Allocating arena memory");
+        }
+      arena->size = new_size;
+      arena->used = 0;
+    }
+
+
+  ptr = arena->block + arena->used;
+  arena->used += bytes;
+  arena->high_water += bytes;
+
+  return (ptr);
+}
+
+
+
+void arena_reset (ARENA *arena)
+{
+  int32_t i;
+
+
+  /*  If we had to chain blocks during the last page, replace them all with one block big enough to hold
+      everything that the page needed.  */
+
+  if (arena->overflow_count)
+    {
+      for (i = 0 ; i < arena->overflow_count ; i++) free (arena->overflow[i]);
+      free (arena->overflow);
+      arena->overflow = NULL;
+      arena->overflow_count = 0;
+
+      if (arena->high_water > arena->size)
+        {
+          free (arena->block);
+          arena->size = arena->high_water;
+          arena->block = (uint8_t *) malloc (arena->size);
+
+
+          /*  Don't jump from here, the caller is cleaning up.  An empty arena just starts over next time.  */
+
+          if (arena->block == NULL)
+            {
+              if (arena->fail == NULL)
+                {
+                  perror ("Allocating arena memory");
+                  exit (-1);
+                }
+              arena->size = 0;
+            }
+        }
+    }
+
+  arena->used = 0;
+  arena->high_water = 0;
+}
+
+
+
+/*  Free everything (without going through arena_reset, which might allocate the one big block first).  */
+
+void arena_free (ARENA *arena)
+{
+  int32_t i;
+
+
+  for (i = 0 ; i < arena->overflow_count ; i++) free (arena->overflow[i]);
+  free (arena->overflow);
+  free (arena->block);
+  memset (arena, 0, sizeof (ARENA));
+}
+
+
+
+void point_buf_grow (POINT_BUF *points, int32_t needed)
+{
+  int32_t new_size;
+
+
+  if (needed <= points->size) return;
+
+  new_size = points->size ? points->size : 4096;
+  while (new_size < needed) new_size *= 2;
+
+
+  points->lat = (double *) realloc (points->lat, new_size * sizeof (double));
+  if (points->lat == NULL)
+    {
+      perror ("Allocating point latitude memory");
+      exit (-1);
+    }
+
+  points->lon = (double *) realloc (points->lon, new_size * sizeof (double));
+  if (points->lon == NULL)
+    {
+      perror ("Allocating point longitude memory");
+      exit (-1);
+    }
+
+  points->dep = (float *) realloc (points->dep, new_size * sizeof (float));
+  if (points->dep == NULL)
+    {
+      perror ("Allocating point depth memory");
+      exit (-1);
+    }
+
+  points->ping = (int32_t *) realloc (points->ping, new_size * sizeof (int32_t));
+  if (points->ping == NULL)
+    {
+      perror ("Allocating point ping memory");
+      exit (-1);
+    }
+
+  points->beam = (int16_t *) realloc (points->beam, new_size * sizeof (int16_t));
+  if (points->beam == NULL)
+    {
+      perror ("Allocating point beam memory");
+      exit (-1);
+    }
+
+  points->size = new_size;
+}
+
+
+
+void point_buf_free (POINT_BUF *points)
+{
+  free (points->lat);
+  free (points->lon);
+  free (points->dep);
+  free (points->ping);
+  free (points->beam);
+  memset (points, 0, sizeof (POINT_BUF));
+}
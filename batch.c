@@ -0,0 +1,644 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+
+#include "gsf_filter.h"
+
+#include <sys/stat.h>
+
+#ifdef NVWIN3X
+    #include <io.h>
+#else
+    #include <glob.h>
+#endif
+
+
+/*  Rough memory use estimate for a file.  A decoded ping takes about DECODE_EXPANSION times as much memory as the
+    encoded ping does in the file (the beam arrays are stored as scaled 1, 2, or 4 byte integers and decoded to
+    doubles).  The worker's point buffer and grid take about WORKER_PAGES decoded pages worth.  */
+
+#define DECODE_EXPANSION      3.0
+#define WORKER_PAGES          1.5
+
+
+static void add_file (BATCH *batch, char *name)
+{
+  batch->file = (char **) realloc (batch->file, (batch->files + 1) * sizeof (char *));
+  if (batch->file == NULL)
+    {
+      perror ("Allocating file list memory");
+      exit (-1);
+    }
+
+  batch->file[batch->files] = strdup (name);
+  if (batch->file[batch->files] == NULL)
+    {
+      perror ("Allocating file name memory");
+      exit (-1);
+    }
+
+  batch->files++;
+}
+
+
+
+/*  Add a file name to the batch.  If the name has wildcards in it we add all of the files that match (in sorted
+    order).  A pattern that doesn't match anything is an error.  */
+
+void batch_add_files (BATCH *batch, char *name)
+{
+  if (strpbrk (name, "*?[") == NULL)
+    {
+      add_file (batch, name);
+      return;
+    }
+
+
+#ifdef NVWIN3X
+
+  {
+    struct _finddata_t  find;
+    intptr_t            hfind;
+    char                path[1024], *slash, *ptr;
+    int32_t             first = batch->files, i, j;
+
+
+    /*  _findfirst only gives us the file name so we have to put the directory back on.  */
+
+    strcpy (path, name);
+    slash = NULL;
+    for (ptr = path ; *ptr ; ptr++) if (*ptr == '/' || *ptr == '\\') slash = ptr;
+    if (slash == NULL)
+      {
+        path[0] = 0;
+      }
+    else
+      {
+        slash[1] = 0;
+      }
+
+    hfind = _findfirst (name, &find);
+    if (hfind == -1)
+      {
+        fprintf (stderr, "No files match %s\n\n", name);
+        exit (-1);
+      }
+
+    do
+      {
+        if (!(find.attrib & _A_SUBDIR))
+          {
+            char file[1024];
+
+            sprintf (file, "%s%s", path, find.name);
+            add_file (batch, file);
+          }
+      } while (!_findnext (hfind, &find));
+
+    _findclose (hfind);
+
+
+    /*  Sort the matches the same way glob does.  */
+
+    for (i = first + 1 ; i < batch->files ; i++)
+      {
+        char *tmp = batch->file[i];
+
+        for (j = i ; j > first && strcmp (batch->file[j - 1], tmp) > 0 ; j--) batch->file[j] = batch->file[j - 1];
+        batch->file[j] = tmp;
+      }
+  }
+
+#else
+
+  {
+    glob_t              matches;
+    size_t              i;
+
+
+    if (glob (name, 0, NULL, &matches))
+      {
+        fprintf (stderr, "No files match %s\n\n", name);
+        exit (-1);
+      }
+
+    for (i = 0 ; i < matches.gl_pathc ; i++) add_file (batch, matches.gl_pathv[i]);
+
+    globfree (&matches);
+  }
+
+#endif
+}
+
+
+
+/*  Add the files named in a list file, one name (or wildcard pattern) per line.  Blank lines and lines starting
+    with # are ignored.  */
+
+void batch_add_list (BATCH *batch, char *list)
+{
+  FILE                *fp;
+  char                string[1024], *name;
+  int32_t             len;
+
+
+  if ((fp = fopen (list, "r")) == NULL)
+    {
+      perror (list);
+      exit (-1);
+    }
+
+  while (fgets (string, sizeof (string), fp) != NULL)
+    {
+      len = strlen (string);
+      while (len && (string[len - 1] == '\n' || string[len - 1] == '\r' || string[len - 1] == ' ' ||
+                     string[len - 1] == '\t')) string[--len] = 0;
+
+      name = string;
+      while (*name == ' ' || *name == '\t') name++;
+
+      if (*name == 0 || *name == '#') continue;
+
+      batch_add_files (batch, name);
+    }
+
+  fclose (fp);
+}
+
+
+
+/*  Record the progress of one file and print the overall progress (weighted by file size) if it changed.  */
+
+void batch_progress (BATCH *batch, int32_t file_num, int32_t percent)
+{
+  double              total = 0.0, processed = 0.0;
+  int32_t             i, overall;
+
+
+  pthread_mutex_lock (&batch->mutex);
+
+  batch->percent[file_num] = percent;
+
+  for (i = 0 ; i < batch->files ; i++)
+    {
+      total += batch->size[i];
+      processed += batch->size[i] * (double) batch->percent[i];
+    }
+
+  overall = total > 0.0 ? (int32_t) (processed / total) : 0;
+
+  if (overall != batch->old_percent)
+    {
+      if (batch->files > 1)
+        {
+          printf ("%3d%% processed (%d of %d files done)    \r", overall, batch->done, batch->files);
+        }
+      else
+        {
+          printf ("%3d%% processed    \r", overall);
+        }
+      fflush (stdout);
+      batch->old_percent = overall;
+    }
+
+  pthread_mutex_unlock (&batch->mutex);
+}
+
+
+
+/*  The filter options that change the flags, the way they're given in the history record comment (and saved in
+    the sidecar header).  The ones that are left at their defaults are left out so that the comment for a plain
+    run is the same as it always was.  options must have room for FILTER_OPTIONS characters.  */
+
+void filter_options (PIPELINE *pipeline, char *options)
+{
+  char                *end;
+
+
+  end = options + sprintf (options, "-std %.1f", pipeline->params.std_env);
+
+  if (pipeline->params.deep) end += sprintf (end, " -d");
+  if (pipeline->params.jacobi) end += sprintf (end, " --jacobi");
+  if (pipeline->fast_georef) end += sprintf (end, " --fast_georef");
+  if (pipeline->halo) end += sprintf (end, " --halo %d", pipeline->halo);
+  if (pipeline->rotate) end += sprintf (end, " --rotate");
+  if (pipeline->params.passes > 1) end += sprintf (end, " --passes %d", pipeline->params.passes);
+  if (pipeline->params.radius > 1) end += sprintf (end, " --radius %d", pipeline->params.radius);
+  if (simd_lane_sums ()) end += sprintf (end, " --lane_sums");
+  if (pipeline->batch != NULL && pipeline->batch->survey)
+    sprintf (end, " --survey --tile_size %.0f", pipeline->batch->tile_size);
+}
+
+
+
+/*  Write a history record describing the filter process (options is from filter_options) to the end of a file.  */
+
+void batch_history (BATCH *batch, char *file, char *options)
+{
+  int32_t             i, hnd, ret;
+  char                comment[16384], **argv;
+
+  int32_t write_history (int32_t, char **, char *, char *, int32_t);
+
+
+  snprintf (comment, sizeof (comment),
+            "This file was statistically filtered using the following program and arguments:\n%s %s %s\n",
+            batch->argv[0], options, file);
+
+
+  /*  The command line in the history record is the options and just this file (the whole batch wouldn't fit).  */
+
+  argv = (char **) malloc ((batch->argc + 1) * sizeof (char *));
+  if (argv == NULL)
+    {
+      perror ("Allocating history memory");
+      exit (-1);
+    }
+
+  for (i = 0 ; i < batch->argc ; i++) argv[i] = batch->argv[i];
+  argv[batch->argc] = file;
+
+
+  /*  Open the file non-indexed so that we can write a history record.  */
+
+  gsf_lock ();
+
+  if (gsfOpen (file, GSF_UPDATE, &hnd))
+    {
+      gsfPrintError (stderr);
+      exit (-1);
+    }
+
+  ret = write_history (batch->argc + 1, argv, comment, file, hnd);
+  if (ret)
+    {
+      fprintf(stderr, "Error: %d - writing gsf history record for %s\n", ret, file);
+    }
+
+  gsfClose (hnd);
+
+  gsf_unlock ();
+
+  free (argv);
+}
+
+
+
+/*  Filter one file of the batch.  pipeline holds the job's point buffer and arena so that they can be reused from
+    one file to the next.  */
+
+static void filter_file (BATCH *batch, int32_t file_num, PIPELINE *pipeline)
+{
+  int32_t             hnd, page_count, beam_size;
+  double              estimate, page_bytes, *beam_lat, *beam_lon, start = 0.0;
+  char                *file = batch->file[file_num], options[FILTER_OPTIONS];
+  uint8_t             mapped;
+  POINT_BUF           points;
+  ARENA               arena;
+  GSF_MAP             map;
+
+
+  /*  Wait until the file fits in the memory budget.  We don't want to open the file with the GSF library (which
+      builds or loads the index) before then, or go through the whole file just to count the pings, so we guess
+      the size of a page from the size of the first ping, which we get by mapping the file (see gsf_map.c).  If
+      it can't be mapped we assume the page could be the whole file.  Nothing is left open while we wait.  */
+
+  page_bytes = batch->size[file_num];
+
+  if (gsf_map_open (&map, file))
+    {
+      if (map.ping_bytes) page_bytes = MIN (page_bytes, (double) map.ping_bytes * batch->options.page_size);
+      gsf_map_close (&map);
+    }
+
+  page_count = batch->options.depth ? 2 * batch->options.depth + 3 : 1;
+  if (batch->options.halo) page_count += 2;
+  estimate = page_bytes * DECODE_EXPANSION * ((double) page_count + WORKER_PAGES);
+
+  pthread_mutex_lock (&batch->mutex);
+
+  while (batch->memory > 0.0 && batch->running && batch->reserved + estimate > batch->memory)
+    pthread_cond_wait (&batch->memory_free, &batch->mutex);
+
+  batch->running++;
+  batch->reserved += estimate;
+
+  pthread_mutex_unlock (&batch->mutex);
+
+
+  /*  In sidecar mode we never write to the file.  With --fast_read the pings are read through the memory map, in
+      order, and the flags are patched in place, so we only open the file with the GSF library to check the pings
+      or if it can't be mapped.  Otherwise it's only opened if something has to be written with gsfWrite (see
+      gsf_write_hnd).  */
+
+  hnd = -1;
+  mapped = batch->options.fast_read && gsf_map_open (&map, file);
+
+  if (!mapped || batch->options.fast_read_check)
+    {
+      gsf_lock ();
+
+      if (gsfOpen (file, batch->options.sidecar ? GSF_READONLY_INDEX : GSF_UPDATE_INDEX, &hnd))
+        {
+          gsfPrintError (stderr);
+          exit (-1);
+        }
+
+      gsf_unlock ();
+    }
+
+
+  printf ("File : %s\n", file);
+  fflush (stdout);
+
+
+  /*  Set up the pipeline from the batch options, keeping the job's buffers.  */
+
+  points = pipeline->points;
+  arena = pipeline->arena;
+  beam_lat = pipeline->beam_lat;
+  beam_lon = pipeline->beam_lon;
+  beam_size = pipeline->beam_size;
+
+  *pipeline = batch->options;
+
+  pipeline->points = points;
+  pipeline->arena = arena;
+  pipeline->beam_lat = beam_lat;
+  pipeline->beam_lon = beam_lon;
+  pipeline->beam_size = beam_size;
+  pipeline->file = file;
+  pipeline->write_hnd = hnd;
+  pipeline->start_rec = 1;
+  pipeline->prev_lat = -999.0;
+  pipeline->prev_lon = -999.0;
+  pipeline->batch = batch;
+  pipeline->file_num = file_num;
+  pipeline->timing = (pipeline->times != NULL || pipeline->profile != NULL);
+  pipeline->patch_fd = -1;
+  if (mapped) pipeline->map = map;
+
+
+  /*  A sidecar run doesn't change the file so it can always just be run again.  */
+
+  pipeline->checkpoint = !pipeline->sidecar;
+  if (pipeline->checkpoint) checkpoint_load (pipeline);
+
+
+  /*  When the stages run in their own threads the reader gets its own read only handle so that it can read ahead
+      of the writer (unless the writer is writing to a sidecar file).  The memory map doesn't need one at all (it
+      opens one if it has to fall back to gsfRead) and the writer patches the flags of the pings read through the
+      map itself.  */
+
+  pipeline->read_hnd = hnd;
+  if (mapped && !pipeline->fast_read_check)
+    {
+      pipeline->read_hnd = -1;
+    }
+  else if (pipeline->depth && !pipeline->sidecar)
+    {
+      gsf_lock ();
+
+      if (gsfOpen (file, GSF_READONLY_INDEX, &pipeline->read_hnd))
+        {
+          gsfPrintError (stderr);
+          exit (-1);
+        }
+
+      gsf_unlock ();
+    }
+
+
+  if (mapped && !pipeline->sidecar) pipeline->patch_fd = gsf_patch_open (file);
+
+  if (pipeline->sidecar) sidecar_open (pipeline);
+
+
+  run_pipeline (pipeline);
+
+
+  if (pipeline->sidecar) sidecar_close (pipeline);
+
+  if (pipeline->patch_fd >= 0) gsf_patch_close (pipeline->patch_fd, file);
+
+  gsf_map_close (&pipeline->map);
+
+  if (pipeline->checkpoint) checkpoint_remove (file);
+
+
+  gsf_lock ();
+
+  if (pipeline->read_hnd >= 0 && pipeline->read_hnd != pipeline->write_hnd) gsfClose (pipeline->read_hnd);
+  if (pipeline->write_hnd >= 0) gsfClose (pipeline->write_hnd);
+
+  gsf_unlock ();
+
+
+  pthread_mutex_lock (&batch->mutex);
+
+  batch->running--;
+  batch->reserved -= estimate;
+  batch->done++;
+  pthread_cond_broadcast (&batch->memory_free);
+
+  pthread_mutex_unlock (&batch->mutex);
+
+  batch_progress (batch, file_num, 100);
+
+
+  if (pipeline->jacobi_check)
+    {
+      printf ("\nJacobi check : %s\n", file);
+      printf ("               %d points filtered by the normal filter, %d flags differ\n", pipeline->classic_total,
+              pipeline->jacobi_only + pipeline->classic_only);
+      printf ("               %d filtered only by the Jacobi filter, %d filtered only by the normal filter\n\n",
+              pipeline->jacobi_only, pipeline->classic_only);
+    }
+
+  if (pipeline->params.passes > 1)
+    {
+      printf ("\nIterations : %s\n", file);
+      printf ("             up to %d passes per page, %lld cells filtered again after the first pass\n\n",
+              pipeline->max_passes, (long long) pipeline->touched);
+    }
+
+  if (pipeline->georef_check)
+    {
+      printf ("\nGeoreference check : %s\n", file);
+      printf ("                    maximum difference from newgp %.4f meters\n\n", pipeline->georef_max);
+    }
+
+  if (pipeline->fast_read_check)
+    {
+      printf ("\nFast read check : %s\n", file);
+      printf ("                  %d pings read through the memory map, %d differ from gsfRead\n",
+              pipeline->map_checked, pipeline->map_differ);
+      printf ("                  %d of them have checksums (rewritten in full instead of patched)\n\n",
+              pipeline->map_checksums);
+    }
+
+
+  /*  In sidecar mode the file hasn't been changed so the history record waits for the apply pass.  */
+
+  if (pipeline->sidecar) return;
+
+
+  if (pipeline->times != NULL) start = stage_clock ();
+
+  filter_options (pipeline, options);
+  batch_history (batch, file, options);
+
+  if (pipeline->times != NULL) pipeline->times->history += stage_clock () - start;
+}
+
+
+
+/*  Each job takes the next file that hasn't been started until there aren't any left.  */
+
+static void *job (void *arg)
+{
+  BATCH *batch = (BATCH *) arg;
+  PIPELINE pipeline;
+  int32_t file_num;
+
+
+  memset (&pipeline, 0, sizeof (PIPELINE));
+
+  while (NVTrue)
+    {
+      pthread_mutex_lock (&batch->mutex);
+      file_num = batch->next++;
+      pthread_mutex_unlock (&batch->mutex);
+
+      if (file_num >= batch->files) break;
+
+      if (batch->apply)
+        {
+          sidecar_apply (batch, file_num);
+        }
+      else
+        {
+          filter_file (batch, file_num, &pipeline);
+        }
+    }
+
+  point_buf_free (&pipeline.points);
+  arena_free (&pipeline.arena);
+  free (pipeline.beam_lat);
+  free (pipeline.beam_lon);
+
+  return (NULL);
+}
+
+
+
+/*  Filter all of the files in the batch.  The calling thread is one of the jobs.  */
+
+void run_batch (BATCH *batch)
+{
+  struct stat         buf;
+  pthread_t           *thread = NULL;
+  int32_t             i;
+
+
+  batch->size = (double *) calloc (batch->files, sizeof (double));
+  batch->percent = (int32_t *) calloc (batch->files, sizeof (int32_t));
+  if (batch->size == NULL || batch->percent == NULL)
+    {
+      perror ("Allocating batch memory");
+      exit (-1);
+    }
+
+  for (i = 0 ; i < batch->files ; i++)
+    {
+      if (stat (batch->file[i], &buf))
+        {
+          perror (batch->file[i]);
+          exit (-1);
+        }
+
+      batch->size[i] = (double) buf.st_size;
+    }
+
+
+  pthread_mutex_init (&batch->mutex, NULL);
+  pthread_cond_init (&batch->memory_free, NULL);
+  batch->next = batch->done = batch->running = 0;
+  batch->reserved = 0.0;
+  batch->old_percent = -1;
+
+  batch->jobs = MAX (1, MIN (batch->jobs, batch->files));
+
+
+  /*  In survey mode the files are all filtered together (see survey.c).  */
+
+  if (batch->survey && !batch->apply)
+    {
+      run_survey (batch);
+    }
+  else
+    {
+      if (batch->jobs > 1)
+        {
+          thread = (pthread_t *) calloc (batch->jobs - 1, sizeof (pthread_t));
+          if (thread == NULL)
+            {
+              perror ("Allocating thread memory");
+              exit (-1);
+            }
+
+          for (i = 0 ; i < batch->jobs - 1 ; i++)
+            {
+              if (pthread_create (&thread[i], NULL, job, batch))
+                {
+                  perror ("Creating job thread");
+                  exit (-1);
+                }
+            }
+        }
+
+
+      job (batch);
+
+
+      for (i = 0 ; i < batch->jobs - 1 ; i++) pthread_join (thread[i], NULL);
+      free (thread);
+    }
+
+
+  if (batch->files > 1)
+    {
+      printf ("%3d%% processed (%d of %d files done)    \n\n", batch->old_percent, batch->done, batch->files);
+    }
+  else
+    {
+      printf ("%3d%% processed    \n\n", batch->old_percent);
+    }
+
+
+  pthread_mutex_destroy (&batch->mutex);
+  pthread_cond_destroy (&batch->memory_free);
+
+  free (batch->size);
+  free (batch->percent);
+}
@@ -0,0 +1,597 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+/*  Benchmark for gsf_filter.  Generates a reproducible synthetic GSF file, filters it through the same batch and
+    pipeline code that gsf_filter uses, and reports the time spent in each stage as pings and soundings per
+    second.  The stages run one after the other by default (--pipeline 0) so that their times don't overlap.  */
+
+#include "gsf_filter.h"
+#include "version.h"
+
+
+/*  The synthetic survey.  The lines are run back and forth at heading and heading + 180, each one offset from the
+    last by 80% of the swath width.  The swath is three times the depth wide (about 112 degrees) and the pings are
+    as far apart along track as the beams are across track.  The seafloor has a 2% cross track slope and a 1% of
+    depth swell along track.  noise is the standard deviation of the depth noise as a fraction of the depth and
+    outliers is the fraction of beams that are moved 10 to 30% of the depth up or down.  Jumps moves the position
+    1500 meters ahead at jumps evenly spaced pings so gsf_filter has to break its pages there (it breaks on jumps
+    of more than 1000 meters).  */
+
+typedef struct
+{
+  int32_t             pings;
+  int32_t             beams;
+  int32_t             lines;
+  int32_t             jumps;
+  double              depth;
+  double              noise;
+  double              outliers;
+  double              heading;
+  uint32_t            seed;
+} SYNTH;
+
+
+/*  We use our own random number generator (xorshift64*) so that the same seed gives the same file everywhere.  */
+
+static uint64_t rng_state;
+
+
+static double uniform ()
+{
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+
+  return ((double) ((rng_state * 2685821657736338717ULL) >> 11) / 9007199254740992.0);
+}
+
+
+
+static double gaussian ()
+{
+  double u1, u2;
+
+
+  u1 = uniform ();
+  u2 = uniform ();
+
+  return (sqrt (-2.0 * log (1.0 - u1)) * cos (2.0 * M_PI * u2));
+}
+
+
+
+static void make_file (SYNTH *synth, char *file)
+{
+  int32_t             hnd, i, j, line_pings, jump_every;
+  double              *depth, *across, *along, swath, spacing, lat, lon, heading, x;
+  uint8_t             *flags;
+  gsfDataID           id;
+  gsfRecords          rec;
+
+
+  rng_state = 0x9e3779b97f4a7c15ULL ^ (uint64_t) synth->seed;
+
+
+  depth = (double *) calloc (synth->beams, sizeof (double));
+  across = (double *) calloc (synth->beams, sizeof (double));
+  along = (double *) calloc (synth->beams, sizeof (double));
+  flags = (uint8_t *) calloc (synth->beams, sizeof (uint8_t));
+  if (depth == NULL || across == NULL || along == NULL || flags == NULL)
+    {
+      perror ("Allocating beam memory");
+      exit (-1);
+    }
+
+
+  if (gsfOpen (file, GSF_CREATE, &hnd))
+    {
+      gsfPrintError (stderr);
+      exit (-1);
+    }
+
+
+  memset (&rec, 0, sizeof (gsfRecords));
+  memset (&id, 0, sizeof (gsfDataID));
+  id.recordID = GSF_RECORD_SWATH_BATHYMETRY_PING;
+
+  swath = synth->depth * 3.0;
+  spacing = swath / (double) synth->beams;
+  line_pings = (synth->pings + synth->lines - 1) / synth->lines;
+  jump_every = synth->jumps ? synth->pings / (synth->jumps + 1) : 0;
+
+  lat = 30.0;
+  lon = -88.0;
+  heading = synth->heading;
+
+
+  for (i = 0 ; i < synth->pings ; i++)
+    {
+      if (i && !(i % line_pings))
+        {
+          /*  Next line.  */
+
+          newgp (lat, lon, heading + 90.0, swath * 0.8, &lat, &lon);
+          heading = fmod (heading + 180.0, 360.0);
+        }
+      else if (i)
+        {
+          newgp (lat, lon, heading, spacing, &lat, &lon);
+        }
+
+      if (jump_every && i && !(i % jump_every) && i / jump_every <= synth->jumps)
+        newgp (lat, lon, heading, 1500.0, &lat, &lon);
+
+
+      for (j = 0 ; j < synth->beams ; j++)
+        {
+          x = ((double) j - (double) (synth->beams - 1) / 2.0) * spacing;
+
+          across[j] = x;
+          along[j] = 0.0;
+          depth[j] = synth->depth + 0.02 * x + 0.01 * synth->depth * sin ((double) i * 0.05) +
+            gaussian () * synth->noise * synth->depth;
+
+          if (uniform () < synth->outliers)
+            depth[j] += (uniform () < 0.5 ? -1.0 : 1.0) * (0.1 + 0.2 * uniform ()) * synth->depth;
+
+          flags[j] = 0;
+        }
+
+
+      /*  Five pings a second.  */
+
+      rec.mb_ping.ping_time.tv_sec = 1577836800 + i / 5;
+      rec.mb_ping.ping_time.tv_nsec = (i % 5) * 200000000;
+      rec.mb_ping.latitude = lat;
+      rec.mb_ping.longitude = lon;
+      rec.mb_ping.heading = heading;
+      rec.mb_ping.number_beams = synth->beams;
+      rec.mb_ping.depth = depth;
+      rec.mb_ping.across_track = across;
+      rec.mb_ping.along_track = along;
+      rec.mb_ping.beam_flags = flags;
+
+      gsfSetDefaultScaleFactor (&rec.mb_ping);
+
+      if (gsfWrite (hnd, &id, &rec) < 0)
+        {
+          gsfPrintError (stderr);
+          exit (-1);
+        }
+    }
+
+
+  gsfClose (hnd);
+
+  free (depth);
+  free (across);
+  free (along);
+  free (flags);
+}
+
+
+
+/*  Check the per cell threshold tests for every instruction set and precision (deep only and two sided), and the
+    default sums, against the original loops on random cells.  For most of the cells sigma_filter is set so that one of the depths is
+    exactly on the limit, or a step to either side of it, since that's where any difference in rounding would
+    show up.  Every version sees the same cells.  Returns the total number of cells that didn't match.  */
+
+static int32_t check_kernels (int32_t cells)
+{
+  static const char *isas[] = {"scalar", "sse4.2", "avx2", "avx512"}, *precisions[] = {"double", "float"};
+  float dep[256];
+  uint8_t expect[256], got[256];
+  double avg, sigma_filter, d, sum, sum2, expect_sum, expect_sum2;
+  int32_t i, p, deep, cell, k, count, expect_count, got_count, mismatches, total = 0;
+
+
+  printf ("%-16s %10s %12s\n", "Kernels", "Cells", "Mismatches");
+
+  for (i = 0 ; i < 4 ; i++)
+    {
+      for (p = 0 ; p < 2 ; p++)
+        {
+          if (!simd_select (isas[i], precisions[p], NVFalse))
+            {
+              printf ("%-16s %10s %12s\n", isas[i], "-", "-");
+              continue;
+            }
+
+          rng_state = 0x9e3779b97f4a7c15ULL;
+          mismatches = 0;
+
+          for (cell = 0 ; cell < cells ; cell++)
+            {
+              count = 1 + (int32_t) (uniform () * 255.0);
+              avg = 1.0 + uniform () * 6000.0;
+
+              for (k = 0 ; k < count ; k++) dep[k] = avg + gaussian () * avg * 0.01;
+
+              expect_sum = expect_sum2 = 0.0;
+              for (k = 0 ; k < count ; k++)
+                {
+                  expect_sum += dep[k];
+                  expect_sum2 += (dep[k] * dep[k]);
+                }
+
+              (*cell_sums) (dep, NULL, count, &sum, &sum2);
+
+              if (sum != expect_sum || sum2 != expect_sum2) mismatches++;
+
+              sigma_filter = uniform () * avg * 0.03;
+
+              switch (cell % 4)
+                {
+                case 1:
+                  sigma_filter = fabs ((double) dep[(int32_t) (uniform () * (double) count)] - avg);
+                  break;
+
+                case 2:
+                  sigma_filter = nextafter (fabs ((double) dep[(int32_t) (uniform () * (double) count)] - avg), 0.0);
+                  break;
+
+                case 3:
+                  sigma_filter = nextafter (fabs ((double) dep[(int32_t) (uniform () * (double) count)] - avg),
+                                            INFINITY);
+                  break;
+                }
+
+              for (deep = 0 ; deep < 2 ; deep++)
+                {
+                  expect_count = 0;
+                  for (k = 0 ; k < count ; k++)
+                    {
+                      d = (double) dep[k] - avg;
+                      expect[k] = deep ? (d >= sigma_filter) : (fabs (d) >= sigma_filter);
+                      expect_count += expect[k];
+                    }
+
+                  got_count = (*cell_test[deep]) (dep, count, avg, sigma_filter, got);
+
+                  if (got_count != expect_count || memcmp (got, expect, count)) mismatches++;
+                }
+            }
+
+          printf ("%-16s %10d %12d\n", simd_name (), cells * 3, mismatches);
+
+          total += mismatches;
+        }
+    }
+
+  printf ("\n");
+
+  return (total);
+}
+
+
+
+
+static void print_stage (char *name, double seconds, STAGE_TIMES *times)
+{
+  if (seconds > 0.0)
+    {
+      printf ("%-12s %10.3f %14.0f %16.0f\n", name, seconds, (double) times->pings / seconds,
+              (double) times->soundings / seconds);
+    }
+  else
+    {
+      printf ("%-12s %10.3f %14s %16s\n", name, seconds, "-", "-");
+    }
+}
+
+
+
+void usage ()
+{
+      fprintf (stderr, "USAGE: gsf_filter_bench [--pings PINGS] [--beams BEAMS] [--depth DEPTH] [--noise NOISE]\n");
+      fprintf (stderr, "                        [--outliers OUTLIERS] [--heading HEADING] [--lines LINES]\n");
+      fprintf (stderr, "                        [--jumps JUMPS] [--seed SEED] [--file FILE] [--keep]\n");
+      fprintf (stderr, "                        [--threads THREADS] [--isa ISA] [--pipeline DEPTH] [--fast_georef]\n");
+      fprintf (stderr, "                        [--precision PRECISION] [--halo HALO] [--rotate] [--passes PASSES]\n");
+      fprintf (stderr, "                        [--radius RADIUS] [--sidecar] [--fast_read] [--lane_sums] [--check]\n\n");
+      fprintf (stderr, "Where:\n");
+      fprintf (stderr, "\tPINGS = Number of pings to generate (default = 20000)\n");
+      fprintf (stderr, "\tBEAMS = Number of beams per ping (default = 256)\n");
+      fprintf (stderr, "\tDEPTH = Average depth in meters (default = 50.0)\n");
+      fprintf (stderr, "\tNOISE = Standard deviation of the depth noise as a fraction of the depth (default = 0.005)\n");
+      fprintf (stderr, "\tOUTLIERS = Fraction of the beams that are outliers (default = 0.02)\n");
+      fprintf (stderr, "\tHEADING = Heading of the first line in degrees (default = 45.0)\n");
+      fprintf (stderr, "\tLINES = Number of lines, run back and forth (default = 1)\n");
+      fprintf (stderr, "\tJUMPS = Number of 1500 meter position jumps (default = 0)\n");
+      fprintf (stderr, "\tSEED = Random number seed (default = 1).  The same options and seed always give the same\n");
+      fprintf (stderr, "\t\tfile.\n");
+      fprintf (stderr, "\tFILE = Name of the synthetic GSF file (default = gsf_filter_bench.gsf)\n");
+      fprintf (stderr, "\t--keep = Don't delete the file when we're done\n");
+      fprintf (stderr, "\t--check = Don't run the benchmark.  Check that every instruction set and precision of the\n");
+      fprintf (stderr, "\t\tthreshold test gives the same flags, and the sums the same values, as the original loops on\n");
+      fprintf (stderr, "\t\trandom cells.\n");
+      fprintf (stderr, "\tTHREADS, ISA, DEPTH, --fast_georef, PRECISION, HALO, --rotate, PASSES, RADIUS, --sidecar,\n");
+      fprintf (stderr, "\t\t--fast_read, and --lane_sums are the same as for gsf_filter except that DEPTH defaults to 0\n");
+      fprintf (stderr, "\t\tso that the stage times don't overlap.\n\n");
+}
+
+
+
+int32_t main (int32_t argc, char **argv)
+{
+  int32_t             i, threads, option_index = 0;
+  char                c, isa[32], precision[32], file[1024];
+  uint8_t             keep = NVFalse, check = NVFalse, lane_sums = NVFalse;
+  double              start, total, generate;
+  SYNTH               synth;
+  STAGE_TIMES         times;
+  BATCH               batch;
+  THREAD_POOL         *pool;
+  extern char         *optarg;
+  static struct option long_options[] = {{"pings", required_argument, 0, 0},
+                                         {"beams", required_argument, 0, 0},
+                                         {"depth", required_argument, 0, 0},
+                                         {"noise", required_argument, 0, 0},
+                                         {"outliers", required_argument, 0, 0},
+                                         {"heading", required_argument, 0, 0},
+                                         {"lines", required_argument, 0, 0},
+                                         {"jumps", required_argument, 0, 0},
+                                         {"seed", required_argument, 0, 0},
+                                         {"file", required_argument, 0, 0},
+                                         {"keep", no_argument, 0, 0},
+                                         {"threads", required_argument, 0, 0},
+                                         {"isa", required_argument, 0, 0},
+                                         {"pipeline", required_argument, 0, 0},
+                                         {"fast_georef", no_argument, 0, 0},
+                                         {"halo", required_argument, 0, 0},
+                                         {"rotate", no_argument, 0, 0},
+                                         {"precision", required_argument, 0, 0},
+                                         {"check", no_argument, 0, 0},
+                                         {"passes", required_argument, 0, 0},
+                                         {"radius", required_argument, 0, 0},
+                                         {"sidecar", no_argument, 0, 0},
+                                         {"fast_read", no_argument, 0, 0},
+                                         {"lane_sums", no_argument, 0, 0},
+                                         {0, no_argument, 0, 0}};
+
+
+
+  printf ("\n\n %s - benchmark \n\n", VERSION);
+
+
+  synth.pings = 20000;
+  synth.beams = 256;
+  synth.lines = 1;
+  synth.jumps = 0;
+  synth.depth = 50.0;
+  synth.noise = 0.005;
+  synth.outliers = 0.02;
+  synth.heading = 45.0;
+  synth.seed = 1;
+  strcpy (file, "gsf_filter_bench.gsf");
+  threads = cpu_count ();
+  strcpy (isa, "auto");
+  strcpy (precision, "double");
+  memset (&batch, 0, sizeof (BATCH));
+  batch.jobs = 1;
+
+
+  while (NVTrue) 
+    {
+      c = (char) getopt_long (argc, argv, "", long_options, &option_index);
+      if (c == -1) break;
+
+      switch (c) 
+        {
+        case 0:
+
+          switch (option_index)
+            {
+            case 0:
+              sscanf (optarg, "%d", &synth.pings);
+              if (synth.pings < 1) synth.pings = 1;
+              break;
+
+            case 1:
+              sscanf (optarg, "%d", &synth.beams);
+              if (synth.beams < 1) synth.beams = 1;
+              break;
+
+            case 2:
+              sscanf (optarg, "%lf", &synth.depth);
+              if (synth.depth < 1.0) synth.depth = 1.0;
+              break;
+
+            case 3:
+              sscanf (optarg, "%lf", &synth.noise);
+              if (synth.noise < 0.0) synth.noise = 0.0;
+              break;
+
+            case 4:
+              sscanf (optarg, "%lf", &synth.outliers);
+              synth.outliers = MAX (0.0, MIN (synth.outliers, 1.0));
+              break;
+
+            case 5:
+              sscanf (optarg, "%lf", &synth.heading);
+              break;
+
+            case 6:
+              sscanf (optarg, "%d", &synth.lines);
+              synth.lines = MAX (1, MIN (synth.lines, synth.pings));
+              break;
+
+            case 7:
+              sscanf (optarg, "%d", &synth.jumps);
+              if (synth.jumps < 0) synth.jumps = 0;
+              break;
+
+            case 8:
+              sscanf (optarg, "%u", &synth.seed);
+              break;
+
+            case 9:
+              strncpy (file, optarg, sizeof (file) - 1);
+              file[sizeof (file) - 1] = 0;
+              break;
+
+            case 10:
+              keep = NVTrue;
+              break;
+
+            case 11:
+              sscanf (optarg, "%d", &threads);
+              if (threads < 1) threads = 1;
+              break;
+
+            case 12:
+              strncpy (isa, optarg, sizeof (isa) - 1);
+              isa[sizeof (isa) - 1] = 0;
+              break;
+
+            case 13:
+              sscanf (optarg, "%d", &batch.options.depth);
+              if (batch.options.depth < 0) batch.options.depth = 0;
+              break;
+
+            case 14:
+              batch.options.fast_georef = NVTrue;
+              break;
+
+            case 15:
+              sscanf (optarg, "%d", &batch.options.halo);
+              batch.options.halo = MAX (0, MIN (batch.options.halo, PINGS_PER_PAGE));
+              break;
+
+            case 16:
+              batch.options.rotate = NVTrue;
+              break;
+
+            case 17:
+              strncpy (precision, optarg, sizeof (precision) - 1);
+              precision[sizeof (precision) - 1] = 0;
+              break;
+
+            case 18:
+              check = NVTrue;
+              break;
+
+            case 19:
+              sscanf (optarg, "%d", &batch.options.params.passes);
+              break;
+
+            case 20:
+              sscanf (optarg, "%d", &batch.options.params.radius);
+              batch.options.params.radius = MIN (batch.options.params.radius, 50);
+              break;
+
+            case 21:
+              batch.options.sidecar = NVTrue;
+              break;
+
+            case 22:
+              batch.options.fast_read = NVTrue;
+              break;
+
+            case 23:
+              lane_sums = NVTrue;
+              break;
+            }
+          break;
+
+        default:
+          usage ();
+          exit (-1);
+          break;
+        }
+    }
+
+
+  if (check) exit (check_kernels (100000) ? -1 : 0);
+
+
+  if (!simd_select (isa, precision, lane_sums))
+    {
+      fprintf (stderr, "Instruction set %s (%s precision) is not supported\n\n", isa, precision);
+      exit (-1);
+    }
+
+
+  start = stage_clock ();
+
+  make_file (&synth, file);
+
+  generate = stage_clock () - start;
+
+  printf ("Generated %s : %d pings of %d beams in %.3f seconds\n", file, synth.pings, synth.beams, generate);
+  printf ("Kernels : %s\n\n", simd_name ());
+
+
+  if ((pool = thread_pool_create (threads)) == NULL) exit (-1);
+
+  batch_add_files (&batch, file);
+
+  memset (&times, 0, sizeof (STAGE_TIMES));
+
+  batch.argc = optind;
+  batch.argv = argv;
+  batch.options.page_size = PINGS_PER_PAGE;
+  batch.options.params.std_env = 2.0;
+  batch.options.params.pool = pool;
+  batch.options.times = &times;
+
+
+  start = stage_clock ();
+
+  run_batch (&batch);
+
+  total = stage_clock () - start;
+
+
+  printf ("\nThreads : %d, pipeline depth : %d\n\n", threads, batch.options.depth);
+  printf ("%-12s %10s %14s %16s\n", "Stage", "Seconds", "Pings/s", "Soundings/s");
+  print_stage ("decode", times.decode, &times);
+  print_stage ("georef", times.georef, &times);
+  print_stage ("bin", times.bin, &times);
+  print_stage ("statistics", times.stats, &times);
+  print_stage ("gsf_filter", times.filter, &times);
+  print_stage ("write", times.write, &times);
+  print_stage ("history", times.history, &times);
+  print_stage ("total", total, &times);
+  printf ("\n%lld pings, %lld soundings\n\n", (long long) times.pings, (long long) times.soundings);
+
+
+  thread_pool_destroy (pool);
+
+  if (!keep)
+    {
+      remove (file);
+
+      if (batch.options.sidecar)
+        {
+          strcat (file, ".flg");
+          remove (file);
+        }
+    }
+
+  for (i = 0 ; i < batch.files ; i++) free (batch.file[i]);
+  free (batch.file);
+
+
+  return (0);
+}
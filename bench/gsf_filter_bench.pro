@@ -0,0 +1,19 @@
+INCLUDEPATH += /c/PFM_ABEv7.0.0_Win64/include
+LIBS += -L /c/PFM_ABEv7.0.0_Win64/lib -lgsf -lnvutility -lgdal -lxml2 -lpoppler -lm -liconv -lwsock32 -lpthread
+DEFINES += NVWIN3X
+CONFIG += console
+CONFIG -= qt
+QMAKE_LFLAGS += 
+######################################################################
+# gsf_filter benchmark.  Builds the filter sources from the directory above (everything but main.c).
+######################################################################
+
+TEMPLATE = app
+TARGET = gsf_filter_bench
+DEPENDPATH += . ..
+INCLUDEPATH += . ..
+
+# Input
+HEADERS += ../gsf_filter.h ../version.h
+SOURCES += gsf_filter_bench.c ../arena.c ../batch.c ../checkpoint.c ../georef.c ../grid.c ../gsf_filter.c ../gsf_map.c ../page.c ../pipeline.c ../sidecar.c ../simd.c ../survey.c \
+           ../thread_pool.c ../window.c ../write_history.c
@@ -0,0 +1,287 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+#include "gsf_filter.h"
+#include <errno.h>
+
+
+/*  Checkpoints.  Before the writer writes a page it records, in FILE.ckp, the filter options, the size of the
+    file, which page it's about to write, the reader state before and after the page (the record to start at and
+    the last position seen, for the jump check), a checksum of the page's beam flags, and the filter flags of the
+    page's changed pings (in the same form as the sidecar files, see sidecar.c).  The checkpoint is written to
+    FILE.ckp.tmp and renamed so there is always a complete one, and it's removed when the file is done.  Before
+    writing a checkpoint we seek the GSF handle, which makes the C library hand the pings it has buffered to the
+    operating system, so all of the pages before the checkpointed page are in the file even if we're killed (the
+    flags patched in place with --fast_read aren't buffered at all).
+
+    The checkpointed page may have been written completely, partly, or not at all when we stopped.  So with
+    --resume we first set the page's flags from the checkpoint (setting a flag twice doesn't hurt), then read the
+    page back in and check its flags against the checksum (that's the only part of the file before the checkpoint
+    that we read again), and then carry on with the next page.  No page is ever filtered twice.  With a halo the
+    page we read back is the first page's previous page, exactly as it would have been if we hadn't stopped, so
+    the results are identical to an uninterrupted run.
+
+    Checkpoints are only there to save time.  If one can't be written (say the directory the file is in isn't
+    writable) we say so once and carry on filtering the file without them.  */
+
+#define CHECKPOINT_VERSION    1
+
+
+static void checkpoint_name (char *file, char *name, uint8_t tmp)
+{
+  snprintf (name, 2048, tmp ? "%s.ckp.tmp" : "%s.ckp", file);
+}
+
+
+
+/*  FNV-1a hash of the record numbers and beam flags of the valid pings in the page that have beam flags.  */
+
+static uint64_t page_checksum (PAGE *page)
+{
+  uint64_t            sum = 14695981039346656037ULL;
+  int32_t             i, j, record;
+  gsfSwathBathyPing   *ping;
+
+
+  for (i = 0 ; i < page->pings ; i++)
+    {
+      ping = &page->ping_rec[i].mb_ping;
+
+      if (!page->valid[i] || ping->beam_flags == NULL) continue;
+
+      record = page->page_start + i;
+
+      for (j = 0 ; j < 4 ; j++) sum = (sum ^ ((record >> (j * 8)) & 0xff)) * 1099511628211ULL;
+
+      for (j = 0 ; j < ping->number_beams ; j++) sum = (sum ^ ping->beam_flags[j]) * 1099511628211ULL;
+    }
+
+  return (sum);
+}
+
+
+
+/*  The options that change the flags have to be the same when we resume.  */
+
+static void option_string (PIPELINE *pipeline, char *options)
+{
+  sprintf (options, "%d %d %d %d %d %d %d %d %d %d", NINT (pipeline->params.std_env * 1000.0),
+           pipeline->params.deep, pipeline->params.jacobi, pipeline->halo, pipeline->rotate, pipeline->fast_georef,
+           pipeline->page_size, pipeline->params.passes, pipeline->params.radius, simd_lane_sums ());
+}
+
+
+
+/*  We couldn't write the checkpoint.  Stop checkpointing the file and get rid of any older checkpoint so that
+    --resume doesn't pick up from the wrong page.  */
+
+static void checkpoint_fail (PIPELINE *pipeline, char *tmp, char *name)
+{
+  fprintf (stderr, "\nCan't write the checkpoint %s (%s), carrying on without checkpoints for %s\n", tmp,
+           strerror (errno), pipeline->file);
+
+  pipeline->checkpoint = NVFalse;
+
+  remove (tmp);
+  remove (name);
+}
+
+
+
+/*  Called by the writer just before it writes a page.  */
+
+void checkpoint_write (PIPELINE *pipeline, PAGE *page)
+{
+  FILE                *fp;
+  char                tmp[2048], name[2048], options[256];
+  int32_t             j, dirty, error;
+
+
+  if (pipeline->write_hnd >= 0)
+    {
+      gsf_lock ();
+
+      if (gsfSeek (pipeline->write_hnd, GSF_REWIND))
+        {
+          gsfPrintError (stderr);
+          exit (-1);
+        }
+
+      gsf_unlock ();
+    }
+
+
+  checkpoint_name (pipeline->file, tmp, NVTrue);
+  checkpoint_name (pipeline->file, name, NVFalse);
+  option_string (pipeline, options);
+
+  if ((fp = fopen (tmp, "wb")) == NULL)
+    {
+      checkpoint_fail (pipeline, tmp, name);
+      return;
+    }
+
+  dirty = 0;
+  for (j = 0 ; j < page->pings ; j++) if (page->dirty[j]) dirty++;
+
+  fprintf (fp, "gsf_filter checkpoint %d\n", CHECKPOINT_VERSION);
+  fprintf (fp, "size %.0f\n", pipeline->batch->size[pipeline->file_num]);
+  fprintf (fp, "options %s\n", options);
+  fprintf (fp, "page %d %d %.17g %.17g\n", page->page_start, page->jump, page->start_lat, page->start_lon);
+  fprintf (fp, "next %d %.17g %.17g\n", page->next_rec, page->end_lat, page->end_lon);
+  fprintf (fp, "checksum %016llx\n", (unsigned long long) page_checksum (page));
+  fprintf (fp, "flags %d\n", dirty);
+
+  for (j = 0 ; j < page->pings ; j++)
+    {
+      if (page->dirty[j]) sidecar_put_flags (fp, &page->ping_rec[j].mb_ping, page->page_start + j);
+    }
+
+  error = ferror (fp);
+
+  if (fclose (fp) || error)
+    {
+      checkpoint_fail (pipeline, tmp, name);
+      return;
+    }
+
+
+  /*  Windows won't rename over an existing file.  */
+
+  remove (name);
+
+  if (rename (tmp, name)) checkpoint_fail (pipeline, tmp, name);
+}
+
+
+
+/*  If we're resuming and there's a checkpoint for the file in the pipeline, set the flags of the checkpointed page
+    and load the checkpoint into pipeline->resume_from.  */
+
+void checkpoint_load (PIPELINE *pipeline)
+{
+  FILE                *fp;
+  char                name[2048], options[256], saved[256];
+  int32_t             version, jump, i, dirty, record, beams;
+  double              size;
+  unsigned long long  checksum;
+  uint8_t             bits[(MAX_SIDECAR_BEAMS + 7) / 8];
+  CHECKPOINT          *resume = &pipeline->resume_from;
+
+
+  memset (resume, 0, sizeof (CHECKPOINT));
+
+  checkpoint_name (pipeline->file, name, NVFalse);
+
+  if ((fp = fopen (name, "rb")) == NULL) return;
+
+  if (!pipeline->resume)
+    {
+      printf ("Ignoring %s, starting at the beginning (use --resume to pick up from it)\n", name);
+      fclose (fp);
+      return;
+    }
+
+
+  if (fscanf (fp, "gsf_filter checkpoint %d size %lf options %255[0-9 -]", &version, &size, saved) != 3 ||
+      version != CHECKPOINT_VERSION ||
+      fscanf (fp, " page %d %d %lf %lf next %d %lf %lf checksum %llx flags %d", &resume->page_start, &jump,
+              &resume->start_lat, &resume->start_lon, &resume->next_rec, &resume->lat, &resume->lon, &checksum,
+              &dirty) != 9 || fgetc (fp) != '\n')
+    {
+      fprintf (stderr, "%s is not a gsf_filter checkpoint file\n", name);
+      exit (-1);
+    }
+
+  resume->jump = (uint8_t) jump;
+  resume->checksum = (uint64_t) checksum;
+
+
+  option_string (pipeline, options);
+
+  if (size != pipeline->batch->size[pipeline->file_num] || strcmp (options, saved))
+    {
+      fprintf (stderr, "%s doesn't match the file or the filter options, remove it to start over\n", name);
+      exit (-1);
+    }
+
+
+  for (i = 0 ; i < dirty ; i++)
+    {
+      if (!sidecar_get_flags (fp, &record, &beams, bits))
+        {
+          fprintf (stderr, "Error reading %s\n", name);
+          exit (-1);
+        }
+
+      if (!sidecar_set_flags (gsf_write_hnd (pipeline), pipeline->file, record, beams, bits))
+        {
+          fprintf (stderr, "%s has changed since its checkpoint was written, remove %s to start over\n",
+                   pipeline->file, name);
+          exit (-1);
+        }
+    }
+
+  fclose (fp);
+
+
+  /*  resume reads the last page back through the read handle or the memory map so the flags we just set have to
+      be out of the write handle's buffer first (the seek flushes it, the same as in checkpoint_write).  */
+
+  if (dirty && pipeline->write_hnd >= 0)
+    {
+      gsf_lock ();
+
+      if (gsfSeek (pipeline->write_hnd, GSF_REWIND))
+        {
+          gsfPrintError (stderr);
+          exit (-1);
+        }
+
+      gsf_unlock ();
+    }
+
+
+  printf ("Resuming at record %d\n", resume->page_start);
+}
+
+
+
+/*  Check the page we read back in against the checkpoint.  */
+
+uint8_t checkpoint_verify (PIPELINE *pipeline, PAGE *page)
+{
+  return (page->jump == pipeline->resume_from.jump && page_checksum (page) == pipeline->resume_from.checksum);
+}
+
+
+
+void checkpoint_remove (char *file)
+{
+  char                name[2048];
+
+
+  checkpoint_name (file, name, NVFalse);
+
+  remove (name);
+}
@@ -0,0 +1,184 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+#include "gsf_filter.h"
+#include "gsf_filter_engine.h"
+
+
+struct GSF_FILTER_ENGINE
+{
+  GSF_FILTER_OPTIONS  options;
+  FILTER_PARAMS       params;
+  ARENA               arena;
+};
+
+
+
+void gsf_filter_engine_defaults (GSF_FILTER_OPTIONS *options)
+{
+  memset (options, 0, sizeof (GSF_FILTER_OPTIONS));
+
+  options->std_env = 2.0;
+  options->threads = 1;
+  options->passes = 1;
+  options->radius = 1;
+}
+
+
+
+/*  The per cell kernels (see simd.c) are shared by the whole program, so they're picked once, by the first engine
+    to be created, and never changed under an engine that's already running.  Every choice gives the same
+    results.  */
+
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+static void pick_kernels ()
+{
+  simd_select ("auto", "double", NVFalse);
+}
+
+
+
+/*  Make an engine.  Returns NULL (after saying why) if we couldn't get the memory or start the threads.  */
+
+GSF_FILTER_ENGINE *gsf_filter_engine_create (const GSF_FILTER_OPTIONS *options)
+{
+  GSF_FILTER_ENGINE *engine;
+
+
+  engine = (GSF_FILTER_ENGINE *) calloc (1, sizeof (GSF_FILTER_ENGINE));
+  if (engine == NULL)
+    {
+      perror ("Allocating filter engine memory");
+      return (NULL);
+    }
+
+  engine->options = *options;
+
+  engine->params.std_env = options->std_env;
+  engine->params.deep = options->deep;
+  engine->params.jacobi = options->jacobi;
+  engine->params.passes = options->passes;
+  engine->params.radius = options->radius;
+  engine->params.pool = thread_pool_create (MAX (1, options->threads));
+
+  if (engine->params.pool == NULL)
+    {
+      free (engine);
+      return (NULL);
+    }
+
+  pthread_once (&kernels_once, pick_kernels);
+
+  return (engine);
+}
+
+
+
+/*  Filter one batch of points.  filtered must have room for (count + 7) / 8 bytes.  Returns the number of points
+    that were filtered, or -1 if we ran out of memory (nothing is filtered and the engine can still be used).  */
+
+int32_t gsf_filter_engine_run (GSF_FILTER_ENGINE *engine, const GSF_FILTER_POINTS *points, uint8_t *filtered)
+{
+  int32_t             i, k, count = points->count, nfiltered;
+  double              sum_z;
+  float               avg_z;
+  NV_F64_XYMBR        mbr;
+  GRID_LAYOUT         layout;
+  GRID                grid;
+  FILTER_PARAMS       *params = &engine->params;
+  jmp_buf             fail;
+
+
+  memset (filtered, 0, (count + 7) / 8);
+
+  if (count <= 0) return (0);
+
+
+  /*  Running out of memory shouldn't take the caller's program down with it, so arena_alloc jumps back here
+      instead of exiting.  All of the arena allocations are made in this thread, before the work is handed to
+      the pool.  */
+
+  engine->arena.fail = &fail;
+
+  if (setjmp (fail))
+    {
+      arena_reset (&engine->arena);
+      engine->arena.fail = NULL;
+      return (-1);
+    }
+
+
+  arena_reset (&engine->arena);
+
+
+  mbr.min_x = mbr.min_y = 1.0e30;
+  mbr.max_x = mbr.max_y = -1.0e30;
+  sum_z = 0.0;
+
+  for (i = 0 ; i < count ; i++)
+    {
+      mbr.min_x = MIN (mbr.min_x, points->x[i]);
+      mbr.max_x = MAX (mbr.max_x, points->x[i]);
+      mbr.min_y = MIN (mbr.min_y, points->y[i]);
+      mbr.max_y = MAX (mbr.max_y, points->y[i]);
+      sum_z += points->z[i];
+    }
+
+  avg_z = (float) sum_z / (float) count;
+
+
+  /*  From here on it's the same code that filter_page runs (see grid.c).  */
+
+  grid_filter (&grid, &layout, &engine->arena, points->x, points->y, points->z, count, &mbr, avg_z,
+               engine->options.metric, params, NULL, NULL);
+
+
+  /*  The grid has the points in cell order, index takes us back to the caller's order.  */
+
+  nfiltered = 0;
+  for (k = 0 ; k < count ; k++)
+    {
+      if (grid.filtered[k])
+        {
+          i = grid.index[k];
+          filtered[i / 8] |= 1 << (i % 8);
+          nfiltered++;
+        }
+    }
+
+  engine->arena.fail = NULL;
+
+  return (nfiltered);
+}
+
+
+
+void gsf_filter_engine_destroy (GSF_FILTER_ENGINE *engine)
+{
+  if (engine == NULL) return;
+
+  thread_pool_destroy (engine->params.pool);
+  arena_free (&engine->arena);
+  free (engine);
+}
@@ -0,0 +1,19 @@
+INCLUDEPATH += /c/PFM_ABEv7.0.0_Win64/include
+LIBS += -L /c/PFM_ABEv7.0.0_Win64/lib -lnvutility -lm -lpthread
+DEFINES += NVWIN3X
+CONFIG += staticlib
+CONFIG -= qt
+QMAKE_LFLAGS += 
+######################################################################
+# gsf_filter engine library (see gsf_filter_engine.h).  Builds the gridding and filtering sources from the
+# directory above.
+######################################################################
+
+TEMPLATE = lib
+TARGET = gsf_filter_engine
+DEPENDPATH += . ..
+INCLUDEPATH += . ..
+
+# Input
+HEADERS += ../gsf_filter.h ../gsf_filter_engine.h
+SOURCES += ../arena.c ../engine.c ../grid.c ../gsf_filter.c ../simd.c ../thread_pool.c ../window.c
@@ -0,0 +1,138 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+
+#include "gsf_filter.h"
+
+
+#define DEG2RAD             (M_PI / 180.0)
+#define RAD2DEG             (180.0 / M_PI)
+
+
+/*  Local tangent plane georeferencing.
+
+    newgp solves the full ellipsoidal direct problem, and the loader used to call it twice for every beam (once for
+    the across track offset and once for the along track offset).  Since every beam in a ping is offset from the
+    same position along the same two azimuths, we can instead build a small frame once per ping and offset the
+    beams with a handful of multiply-adds.
+
+    With the ping at latitude phi, M and N the meridional and prime vertical radii of curvature there, e2 the first
+    eccentricity squared, W2 = 1 - e2 * sin (phi) * sin (phi), (ax, ay) the east and north components of the across
+    track offset, and (tx, ty) those of the along track offset (x = ax + tx, y = ay + ty), we use the second order
+    expansion of the two newgp calls:
+
+        dlat = y / M  -  ax * ax * tan (phi) / (2 * M * N)  -  ay * ay * 3 * e2 * sin (phi) * cos (phi) / (2 * M * M * W2)
+
+        dlon = x / (N * cos (phi))  +  ax * ay * (tan (phi) / N + T / M) / (2 * N * cos (phi))
+                                    +  tx * ay * T / (M * N * cos (phi))
+
+    where T = tan (phi) - e2 * sin (phi) * cos (phi) / W2.  These come from differentiating the geodesic equations
+    (dlat/ds = cos (az) / M, dlon/ds = sin (az) / (N * cos (phi)), daz/ds = sin (az) * tan (phi) / N).  The last
+    term accounts for the along track offset being applied at the across track position instead of at the ping.
+    The along track offsets are small so the terms that are second order in them are left out.
+
+    The error is third order in the offset and grows with tan (phi).  Against newgp on WGS-84, for swath widths up
+    to 10 km (5 km either side of nadir) and along track offsets up to 50 m, the maximum error is 1 mm up to 30
+    degrees of latitude, 4 mm up to 60 degrees, 1.5 cm up to 75 degrees, and 3.5 cm up to 80 degrees.  A grid
+    cell is about 7 cm across for every meter of depth so, in anything but very shallow water, this makes no
+    difference to the filter.  Use --georef_check to see the actual maximum for a file.  */
+
+void ltp_frame (double lat, double lon, double heading, LTP_FRAME *frame)
+{
+  double              a, e2, phi, sin_phi, cos_phi, tan_phi, w2, m, n, across, along;
+
+
+  a = NV_A0;
+  e2 = 1.0 - (NV_B0 * NV_B0) / (NV_A0 * NV_A0);
+
+  phi = lat * DEG2RAD;
+  sin_phi = sin (phi);
+  cos_phi = cos (phi);
+  tan_phi = sin_phi / cos_phi;
+
+  w2 = 1.0 - e2 * sin_phi * sin_phi;
+  m = a * (1.0 - e2) / (w2 * sqrt (w2));
+  n = a / sqrt (w2);
+
+
+  /*  Unit vectors (east, north) of the across track (heading + 90) and along track (heading) directions.  */
+
+  across = (heading + 90.0) * DEG2RAD;
+  along = heading * DEG2RAD;
+
+  frame->lat = lat;
+  frame->lon = lon;
+  frame->across_x = sin (across);
+  frame->across_y = cos (across);
+  frame->along_x = sin (along);
+  frame->along_y = cos (along);
+
+
+  /*  Everything in degrees so the beams don't need any conversions.  */
+
+  frame->ky = RAD2DEG / m;
+  frame->kx = RAD2DEG / (n * cos_phi);
+  frame->kxx = -RAD2DEG * tan_phi / (2.0 * m * n);
+  frame->kyy = -RAD2DEG * 3.0 * e2 * sin_phi * cos_phi / (2.0 * m * m * w2);
+  frame->kxy = RAD2DEG * (tan_phi / n + (tan_phi - e2 * sin_phi * cos_phi / w2) / m) / (2.0 * n * cos_phi);
+  frame->kty = RAD2DEG * (tan_phi - e2 * sin_phi * cos_phi / w2) / (m * n * cos_phi);
+}
+
+
+
+/*  Georeference "beams" beams of a ping.  along may be NULL.  There are no branches or calls in the loops so the
+    compiler can vectorize them.  */
+
+void ltp_beams (const LTP_FRAME *frame, const double *across, const double *along, int32_t beams, double *lat,
+                double *lon)
+{
+  double              x, y, ax, ay, tx;
+  int32_t             i;
+
+
+  if (along == NULL)
+    {
+      for (i = 0 ; i < beams ; i++)
+        {
+          x = across[i] * frame->across_x;
+          y = across[i] * frame->across_y;
+
+          lat[i] = frame->lat + frame->ky * y + frame->kxx * x * x + frame->kyy * y * y;
+          lon[i] = frame->lon + frame->kx * x + frame->kxy * x * y;
+        }
+    }
+  else
+    {
+      for (i = 0 ; i < beams ; i++)
+        {
+          ax = across[i] * frame->across_x;
+          ay = across[i] * frame->across_y;
+          tx = along[i] * frame->along_x;
+          x = ax + tx;
+          y = ay + along[i] * frame->along_y;
+
+          lat[i] = frame->lat + frame->ky * y + frame->kxx * ax * ax + frame->kyy * ay * ay;
+          lon[i] = frame->lon + frame->kx * x + frame->kxy * ax * ay + frame->kty * tx * ay;
+        }
+    }
+}
@@ -0,0 +1,451 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+
+#include "gsf_filter.h"
+
+
+/*  Sparse grid.
+
+    The page grid only stores the cells that have points in them so the memory it takes depends on the number of
+    points, not on the size of the page's MBR.  That means we never have to coarsen the grid to keep it in
+    memory.  A turn, or a single bad position, just leaves a lot of empty cells that we don't store.
+
+    The cells are kept in raster order (row n, then column m), the same order the old dense grid was swept in, and
+    each cell gets the indices of its 3 by 3 neighborhood (in raster order, with -1 for empty or off the grid).  An
+    empty cell never took part in the filter anyway so the filter gives exactly the same answer it did with the
+    dense grid.
+
+    We find the cells with an open addressing hash table keyed on n * width + m.  The table and the other
+    scratch arrays come from the page arena.  */
+
+typedef struct
+{
+  int64_t             key;
+  int32_t             id;
+} CELL_KEY;
+
+
+static int compare_keys (const void *a, const void *b)
+{
+  const CELL_KEY *ka = (const CELL_KEY *) a, *kb = (const CELL_KEY *) b;
+
+  if (ka->key < kb->key) return (-1);
+  if (ka->key > kb->key) return (1);
+  if (ka->id < kb->id) return (-1);
+  if (ka->id > kb->id) return (1);
+  return (0);
+}
+
+
+
+/*  Hash table slot for key.  Returns the slot holding key or the empty slot where it belongs.  */
+
+static uint32_t find_slot (const int64_t *table, uint32_t mask, int64_t key)
+{
+  uint32_t slot;
+
+
+  slot = (uint32_t) (((uint64_t) key * 0x9e3779b97f4a7c15ULL) >> 32) & mask;
+
+  while (table[slot] != -1 && table[slot] != key) slot = (slot + 1) & mask;
+
+  return (slot);
+}
+
+
+
+/*  Build the grid for "count" points at x, y with depths dep.  Cell n, m covers min_y + n * cell_size through
+    min_y + (n + 1) * cell_size in y and the same for m in x.  height and width are the size of the (virtual) dense
+    grid.  If tiled is set we also work out the tile order for the multithreaded sweep (see gsf_filter.c).  */
+
+void grid_build (GRID *grid, ARENA *arena, const double *x, const double *y, const float *dep, int32_t count,
+                 double min_x, double min_y, double cell_size, int32_t height, int32_t width, uint8_t tiled)
+{
+  int64_t             key, *table;
+  int32_t             i, k, c, n, m, di, dj, cells, *value, *point_cell, *cell_count, *rank;
+  uint32_t            size, mask, slot;
+  CELL_KEY            *keys;
+
+
+  memset (grid, 0, sizeof (GRID));
+  grid->height = height;
+  grid->width = width;
+
+
+  /*  The hash table is at least twice the number of points (so at least twice the number of cells) and a power of
+      two.  */
+
+  for (size = 1024 ; size < 2 * (uint32_t) count ; size *= 2);
+  mask = size - 1;
+
+  table = (int64_t *) arena_alloc (arena, size * sizeof (int64_t));
+  value = (int32_t *) arena_alloc (arena, size * sizeof (int32_t));
+  memset (table, 0xff, size * sizeof (int64_t));
+
+
+  /*  Find the cell for each point, numbering the cells in the order we first see them, and count the points per
+      cell.  */
+
+  point_cell = (int32_t *) arena_alloc (arena, count * sizeof (int32_t));
+  cell_count = (int32_t *) arena_alloc (arena, count * sizeof (int32_t));
+  keys = (CELL_KEY *) arena_alloc (arena, count * sizeof (CELL_KEY));
+
+  cells = 0;
+  for (i = 0 ; i < count ; i++)
+    {
+      m = (int32_t) ((x[i] - min_x) / cell_size);
+      n = (int32_t) ((y[i] - min_y) / cell_size);
+      key = (int64_t) n * width + m;
+
+      slot = find_slot (table, mask, key);
+      if (table[slot] == -1)
+        {
+          table[slot] = key;
+          value[slot] = cells;
+          keys[cells].key = key;
+          keys[cells].id = cells;
+          cell_count[cells] = 0;
+          cells++;
+        }
+
+      point_cell[i] = value[slot];
+      cell_count[point_cell[i]]++;
+    }
+
+
+  /*  Put the cells in raster order.  rank takes us from the order we first saw a cell in to its raster order.  */
+
+  qsort (keys, cells, sizeof (CELL_KEY), compare_keys);
+
+  rank = (int32_t *) arena_alloc (arena, cells * sizeof (int32_t));
+  for (c = 0 ; c < cells ; c++) rank[keys[c].id] = c;
+
+
+  grid->cells = cells;
+  grid->row = (int32_t *) arena_alloc (arena, cells * sizeof (int32_t));
+  grid->col = (int32_t *) arena_alloc (arena, cells * sizeof (int32_t));
+  grid->neighbor = (int32_t *) arena_alloc (arena, cells * 9 * sizeof (int32_t));
+  grid->avg = (float *) arena_alloc (arena, cells * sizeof (float));
+  grid->std = (float *) arena_alloc (arena, cells * sizeof (float));
+  grid->count = (int32_t *) arena_alloc (arena, cells * sizeof (int32_t));
+  grid->start = (int32_t *) arena_alloc (arena, cells * sizeof (int32_t));
+  grid->cleared = (uint8_t *) arena_alloc (arena, cells);
+  grid->index = (int32_t *) arena_alloc (arena, count * sizeof (int32_t));
+  grid->depth = (float *) arena_alloc (arena, count * sizeof (float));
+  grid->filtered = (uint8_t *) arena_alloc (arena, count);
+
+  memset (grid->cleared, 0, cells);
+  memset (grid->filtered, 0, count);
+
+
+  /*  Give each cell its slice of the contiguous index array (start is used as the fill position and backed up
+      afterwards) and scatter the point indices (and depths) into the slices.  Points stay in input order within
+      each cell.  */
+
+  k = 0;
+  for (c = 0 ; c < cells ; c++)
+    {
+      grid->row[c] = (int32_t) (keys[c].key / width);
+      grid->col[c] = (int32_t) (keys[c].key % width);
+      grid->count[c] = cell_count[keys[c].id];
+      grid->start[c] = k;
+      k += grid->count[c];
+    }
+
+  for (i = 0 ; i < count ; i++)
+    {
+      k = grid->start[rank[point_cell[i]]]++;
+      grid->index[k] = i;
+      grid->depth[k] = dep[i];
+    }
+
+  for (c = 0 ; c < cells ; c++) grid->start[c] -= grid->count[c];
+
+
+  /*  Look up the neighborhood of each cell.  */
+
+  for (c = 0 ; c < cells ; c++)
+    {
+      n = grid->row[c];
+      m = grid->col[c];
+
+      for (di = -1 ; di <= 1 ; di++)
+        {
+          for (dj = -1 ; dj <= 1 ; dj++)
+            {
+              k = c * 9 + (di + 1) * 3 + dj + 1;
+              grid->neighbor[k] = -1;
+
+              if (n + di >= 0 && n + di < height && m + dj >= 0 && m + dj < width)
+                {
+                  slot = find_slot (table, mask, (int64_t) (n + di) * width + m + dj);
+                  if (table[slot] != -1) grid->neighbor[k] = rank[value[slot]];
+                }
+            }
+        }
+    }
+
+
+  /*  The multithreaded sweep works on tiles of TILE_ROWS rows by TILE_COLS columns of skewed column (n + m).  Tile
+      ti, tj goes in wave ti + tj.  We sort the cells by wave and tile, keeping them in raster order within each
+      tile (the sort key includes the cell index).  Only tiles with cells in them exist.  */
+
+  if (tiled)
+    {
+      for (c = 0 ; c < cells ; c++)
+        {
+          n = grid->row[c];
+          m = grid->col[c];
+
+          keys[c].key = ((int64_t) (n / TILE_ROWS + (n + m) / TILE_COLS) << 32) | (int64_t) (n / TILE_ROWS);
+          keys[c].id = c;
+        }
+
+      qsort (keys, cells, sizeof (CELL_KEY), compare_keys);
+
+
+      grid->order = (int32_t *) arena_alloc (arena, cells * sizeof (int32_t));
+      grid->tile_start = (int32_t *) arena_alloc (arena, (cells + 1) * sizeof (int32_t));
+      grid->wave_start = (int32_t *) arena_alloc (arena, (cells + 1) * sizeof (int32_t));
+
+      grid->tiles = grid->waves = 0;
+      for (c = 0 ; c < cells ; c++)
+        {
+          grid->order[c] = keys[c].id;
+
+          if (!c || keys[c].key != keys[c - 1].key)
+            {
+              if (!c || (keys[c].key >> 32) != (keys[c - 1].key >> 32)) grid->wave_start[grid->waves++] = grid->tiles;
+              grid->tile_start[grid->tiles++] = c;
+            }
+        }
+
+      grid->tile_start[grid->tiles] = cells;
+      grid->wave_start[grid->waves] = grid->tiles;
+    }
+}
+
+
+
+/*  Work out the grid cells for points in mbr with an average depth of avg_z.  The cell size is based on a straight
+    down, one-degree footprint size for the average depth, times 4.  If metric is set the coordinates are meters,
+    otherwise they're degrees (and we use the footprint size in degrees of latitude for both directions).  */
+
+void grid_layout (NV_F64_XYMBR *mbr, float avg_z, uint8_t metric, GRID_LAYOUT *layout)
+{
+  double              rlat1, rlon1, rlat2, rlon2, az;
+
+
+  layout->grid_size = avg_z * 0.017453736 * 4.0 / 111120.0;
+  layout->cell_size = metric ? layout->grid_size * 111120.0 : layout->grid_size;
+  layout->coarsened = 0;
+
+
+  /*  The row and column numbers have to fit in 32 bits.  This can only matter for a wildly bad position in very
+      shallow water.  */
+
+  while ((mbr->max_y - mbr->min_y) / layout->cell_size > 1.0e9 ||
+         (mbr->max_x - mbr->min_x) / layout->cell_size > 1.0e9)
+    {
+      layout->grid_size *= 2.0;
+      layout->cell_size *= 2.0;
+      layout->coarsened++;
+    }
+
+  layout->height = NINT (((mbr->max_y - mbr->min_y)) / layout->cell_size + 1.0);
+  layout->width = NINT (((mbr->max_x - mbr->min_x)) / layout->cell_size + 1.0);
+
+
+  /*  Compute the diagonal in meters of a grid cell at the center of the grid.  */
+
+  if (metric)
+    {
+      layout->dx = layout->cell_size * M_SQRT2;
+    }
+  else
+    {
+      rlat1 = mbr->min_y + (mbr->max_y - mbr->min_y) / 2.0;
+      rlon1 = mbr->min_x + (mbr->max_x - mbr->min_x) / 2.0;
+      rlat2 = rlat1 + layout->grid_size;
+      rlon2 = rlon1 + layout->grid_size;
+
+      invgp (NV_A0, NV_B0, rlat1, rlon1, rlat2, rlon2, &layout->dx, &az);
+    }
+}
+
+
+
+/*  Compute the average and standard deviation for each grid cell (and make room for the Jacobi filter's
+    snapshot, the worklists for the passes after the first, and the window sums if we need them).  */
+
+void grid_stats (GRID *grid, ARENA *arena, FILTER_PARAMS *params)
+{
+  int32_t             i;
+  double              sum_z, sum2_z;
+
+
+  if (params->jacobi || params->passes > 1 || params->radius > 1)
+    {
+      grid->snap_avg = (float *) arena_alloc (arena, grid->cells * sizeof (float));
+      grid->snap_std = (float *) arena_alloc (arena, grid->cells * sizeof (float));
+      grid->snap_active = (uint8_t *) arena_alloc (arena, grid->cells);
+    }
+
+  if (params->passes > 1)
+    {
+      grid->changed = (uint8_t *) arena_alloc (arena, grid->cells);
+      grid->work = (int32_t *) arena_alloc (arena, grid->cells * sizeof (int32_t));
+      grid->next = (int32_t *) arena_alloc (arena, grid->cells * sizeof (int32_t));
+      grid->mark = (uint8_t *) arena_alloc (arena, grid->cells);
+
+      memset (grid->mark, 0, grid->cells);
+    }
+
+  if (params->radius > 1) window_alloc (grid, arena, params->radius);
+
+  /*  The averages are floats so their squares are exact in double (and the same as the pow (avg, 2.0) we used to
+      use).  */
+
+  for (i = 0 ; i < grid->cells ; i++)
+    {
+      (*cell_sums) (&grid->depth[grid->start[i]], NULL, grid->count[i], &sum_z, &sum2_z);
+
+      grid->avg[i] = sum_z / (double) grid->count[i];
+
+      if (grid->count[i] > 1)
+        {
+          grid->std[i] = sqrt ((sum2_z - ((double) grid->count[i] * ((double) grid->avg[i] * (double) grid->avg[i]))) / 
+                               ((double) grid->count[i] - 1.0));
+        } 
+      else 
+        {
+          grid->std[i] = 0.0;
+        }
+    }
+}
+
+
+
+/*  Wall clock seconds for the stage timing.  */
+
+double stage_clock ()
+{
+  struct timespec     now;
+
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+
+  return ((double) now.tv_sec + (double) now.tv_nsec * 1.0e-9);
+}
+
+
+
+/*  Grid and filter count points (x, y, dep) that fit in mbr and have an average depth of avg_z.  This is the whole
+    filter for a set of points.  filter_page and the engine library (engine.c) both come through here so the
+    library runs the same code as the program.  The flags are left in grid->filtered in cell order (grid->index
+    takes them back to the order of the points).
+
+    If profile isn't NULL the grid size, the pass counts, and the bin, stats, and filter times are put in it.  If
+    classic isn't NULL (--jacobi_check) the normal filter is run first and its flags are put in classic, then the
+    cell statistics are put back the way they were for the Jacobi filter.  */
+
+void grid_filter (GRID *grid, GRID_LAYOUT *layout, ARENA *arena, const double *x, const double *y,
+                  const float *dep, int32_t count, NV_F64_XYMBR *mbr, float avg_z, uint8_t metric,
+                  FILTER_PARAMS *params, PAGE_PROFILE *profile, uint8_t *classic)
+{
+  int32_t             cells;
+  double              start = 0.0, now;
+  uint8_t             *save_cleared;
+  float               *save_avg, *save_std;
+
+
+  if (profile != NULL) start = stage_clock ();
+
+
+  grid_layout (mbr, avg_z, metric, layout);
+
+
+  /*  Build the grid from the input points.  Only the cells that have points in them are stored so we never have
+      to make the cells bigger to fit the grid in memory.  */
+
+  grid_build (grid, arena, x, y, dep, count, mbr->min_x, mbr->min_y, layout->cell_size, layout->height,
+              layout->width, (params->pool != NULL && params->pool->threads));
+
+  cells = grid->cells;
+
+  if (profile != NULL)
+    {
+      profile->grid_height = layout->height;
+      profile->grid_width = layout->width;
+      profile->grid_size = layout->grid_size;
+      profile->coarsened = layout->coarsened;
+      profile->cells = cells;
+
+      now = stage_clock ();
+      profile->bin = now - start;
+      start = now;
+    }
+
+
+  grid_stats (grid, arena, params);
+
+  if (profile != NULL)
+    {
+      now = stage_clock ();
+      profile->stats = now - start;
+      start = now;
+    }
+
+
+  if (classic != NULL)
+    {
+      save_avg = (float *) arena_alloc (arena, cells * sizeof (float));
+      save_std = (float *) arena_alloc (arena, cells * sizeof (float));
+      save_cleared = (uint8_t *) arena_alloc (arena, cells);
+
+      memcpy (save_avg, grid->avg, cells * sizeof (float));
+      memcpy (save_std, grid->std, cells * sizeof (float));
+      memcpy (save_cleared, grid->cleared, cells);
+
+      params->jacobi = NVFalse;
+      gsf_filter (grid, layout->dx, params);
+      params->jacobi = NVTrue;
+
+      memcpy (classic, grid->filtered, count);
+
+      memcpy (grid->avg, save_avg, cells * sizeof (float));
+      memcpy (grid->std, save_std, cells * sizeof (float));
+      memcpy (grid->cleared, save_cleared, cells);
+    }
+
+
+  gsf_filter (grid, layout->dx, params);
+
+  if (profile != NULL)
+    {
+      profile->passes = grid->passes;
+      profile->touched = grid->touched;
+      profile->filter = stage_clock () - start;
+    }
+}
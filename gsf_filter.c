@@ -23,177 +23,564 @@
 
 #include "gsf_filter.h"
 
-void gsf_filter (GRID_REC **grid, int32_t height, int32_t width, float *adep, double dx,
-                 float std_env, uint8_t deep)
+/*  Cells per task for the Jacobi sweep.  */
+
+#define JACOBI_CELLS    4096
+
+
+/*  Points per block when a cell is filtered again (see refilter_points).  */
+
+#define REFILTER_POINTS 256
+
+
+typedef struct
+{
+  GRID                *grid;
+  double              dx;
+  float               std_env;
+  CELL_TEST           test;
+  int32_t             first_tile;
+  int32_t             *work;                /*  Cells to filter again, NULL for the first pass  */
+  int32_t             work_count;
+} FILTER_ARGS;
+
+
+
+/*  Compute the composite average and standard deviation of a neighborhood from the sums of the cell averages,
+    standard deviations, and squared averages of the sumcount cells in it.  */
+
+static void composite_stats (int32_t sumcount, double avgsum, double stdsum, double sum2, uint8_t flat, double *avg,
+                             double *std)
+{
+  /*  If the slope is low (< 1 degree) we'll use an average of the cell standard deviations to beat the
+      depths against.  Otherwise, we'll compute the standard deviation from the cell averages.  Since we're
+      using the average of the computed standard deviations of all of the nine cells or the standard
+      deviations of the averages of all nine cells we multiply the resulting standard deviation (?) by two
+      to get a reasonable result, otherwise the standard deviation surface is too smooth and we end up
+      cutting out too much good data.  I must admit I arrived at these numbers by playing with the filter
+      using em3000 shallow water data and em121a deep water data but they appear to work properly.  This
+      way three sigma seems to cut out what you would expect three sigma to cut out.  If you leave it as is
+      it cuts out about 30%.  This is called empirically determining a value (From Nero's famous statement
+      "I'm the emperor and I can do what I damn well please, now hand me my fiddle.").   JCD  */
+
+  *avg = avgsum / (double) sumcount; 
+  if (flat || sumcount < 2)
+    {
+      *std = (stdsum / (double) sumcount) * 2.0;
+    }
+  else
+    {
+      *std = (sqrt ((sum2 - ((double) sumcount * (*avg * *avg))) / ((double) sumcount - 1.0))) * 2.0;
+    }
+}
+
+
+
+/*  Recompute the average and standard deviation of cell c from the left points that haven't been filtered (or
+    mark the cell cleared if there aren't any).  If we're making more than one pass note that the cell changed.  */
+
+static void update_cell (GRID *grid, int32_t c, int32_t left)
+{
+  int32_t count;
+  double sum_filtered, sum2_filtered;
+  float *dep;
+  uint8_t *filtered;
+
+
+  if (grid->changed != NULL) grid->changed[c] = NVTrue;
+
+  if (!left)
+    {
+      grid->cleared[c] = NVTrue;
+      return;
+    }
+
+  count = grid->count[c];
+  dep = &grid->depth[grid->start[c]];
+  filtered = &grid->filtered[grid->start[c]];
+
+  (*cell_sums) (dep, filtered, count, &sum_filtered, &sum2_filtered);
+
+  grid->avg[c] = sum_filtered / (double) left; 
+  if (left > 1)
+    {
+      grid->std[c] = sqrt ((sum2_filtered - ((double) left * ((double) grid->avg[c] * (double) grid->avg[c]))) / 
+                           ((double) left - 1.0));
+    }
+  else
+    {
+      grid->std[c] = 0.0;
+    }
+}
+
+
+
+/*  Test the points in cell c against the composite average and standard deviation of its neighborhood.  If any
+    of them are filtered we recompute the cell's own average and standard deviation from the points that are left
+    (or mark the cell cleared if there aren't any).  */
+
+static void filter_points (FILTER_ARGS *args, int32_t c, double avg, double std)
+{
+  int32_t count, filtered_count;
+  GRID *grid = args->grid;
+
+
+  count = grid->count[c];
+
+
+  /*  The cell's points are contiguous in the depth and filtered arrays.  Check them (args->test is the deep only
+      test if deep is set).  */
+
+  filtered_count = count - (*args->test) (&grid->depth[grid->start[c]], count, avg, args->std_env * std,
+                                          &grid->filtered[grid->start[c]]);
+
+  if (filtered_count < count) update_cell (grid, c, filtered_count);
+}
+
+
+
+/*  Same as filter_points for a cell that has already been filtered in an earlier pass.  The points that were
+    filtered stay filtered and the cell's statistics only change if more points are filtered this time.  The test
+    is done in blocks so we can keep the earlier flags on the stack.  */
+
+static void refilter_points (FILTER_ARGS *args, int32_t c, double avg, double std)
+{
+  int32_t count, k, n, i, added = 0, left = 0;
+  uint8_t old[REFILTER_POINTS], *filtered;
+  float *dep;
+  GRID *grid = args->grid;
+
+
+  count = grid->count[c];
+  dep = &grid->depth[grid->start[c]];
+  filtered = &grid->filtered[grid->start[c]];
+
+  for (k = 0 ; k < count ; k += REFILTER_POINTS)
+    {
+      n = MIN (REFILTER_POINTS, count - k);
+
+      memcpy (old, &filtered[k], n);
+
+      (*args->test) (&dep[k], n, avg, args->std_env * std, &filtered[k]);
+
+      for (i = 0 ; i < n ; i++)
+        {
+          added += filtered[k + i] & !old[i];
+          filtered[k + i] |= old[i];
+          left += !filtered[k + i];
+        }
+    }
+
+  if (added) update_cell (grid, c, left);
+}
+
+
+
+/*  Filter the points in cell c (and update the cell's statistics).  */
+
+static void filter_cell (FILTER_ARGS *args, int32_t c)
 {
-  int32_t i, j, m, n, filtered_count, sumcount;
-  uint8_t flat, recompflag;
-  double sum_filtered, sum2_filtered, sum2, avgsum, stdsum, avg, std, slope, sigma_filter;
+  int32_t k, nc, sumcount;
+  uint8_t flat;
+  double sum2, avgsum, stdsum, avg, std, slope;
+  int32_t *neighbor;
+  GRID *grid = args->grid;
+
 
+  neighbor = &grid->neighbor[c * 9];
 
-  /*  Loop through the temporary grid and filter the data.  */
+  sumcount = 0;
+  sum2 = 0.0;
+  stdsum = 0.0;
+  avgsum = 0.0;
 
-  for (n = 0 ; n < height ; n++)
+
+  /*  Get the information from the 8 cells surrounding this cell to compute the composite standard deviation and
+      average.  Empty cells and cells off the edge of the grid are -1.  */
+
+  for (k = 0 ; k < 9 ; k++)
     {
-      for (m = 0 ; m < width ; m++)
+      nc = neighbor[k];
+
+      if (nc >= 0 && !grid->cleared[nc])
         {
-          sumcount = 0;
-          sum2 = 0.0;
-          stdsum = 0.0;
-          avgsum = 0.0;
+          avgsum += grid->avg[nc];
+          stdsum += grid->std[nc];
+          sum2 += grid->avg[nc] * grid->avg[nc];
+
+          sumcount++;
+        }
+    }
 
 
-          /*  Don't try to filter empty bins.  */
+  /*  Compute the eight slopes from the center cell to find out if it's flat enough to use the average of the
+      standard deviations or if we need to use the standard deviation of the averages.  We use a reference slope
+      of 1 degree to determine which we need to use.  */
+
+  flat = NVTrue;
+  for (k = 0 ; k < 9 ; k++)
+    {
+      nc = neighbor[k];
 
-          if (grid[n][m].count)
+      /*  Don't use the center cell.  */
+
+      if (k != 4 && nc >= 0 && !grid->cleared[nc])
+        {
+          slope = (fabsf (grid->avg[c] - grid->avg[nc])) / args->dx;
+              
+          if (slope > 1.0)
             {
-              /*  Get the information from the 8 cells surrounding this cell to compute the composite
-                  standard deviation and average.  */
+              flat = NVFalse;
+              break;
+            }
+        }
+    }
 
-              for (i = n - 1 ; i <= n + 1 ; i++)
-                {
-                  for (j = m - 1 ; j <= m + 1 ; j++)
-                    {
-                      /*  Make sure each cell is in the area (edge effect).  */
-
-                      if (i >= 0 && i < height && j >= 0 && j < width)
-                        {
-                          if (grid[i][j].count && !grid[i][j].cleared)
-                            {
-                              avgsum += grid[i][j].avg;
-                              stdsum += grid[i][j].std;
-                              sum2 += grid[i][j].avg * grid[i][j].avg;
-
-                              sumcount++;
-                            }
-                        }
-                    }
-                }
 
+  composite_stats (sumcount, avgsum, stdsum, sum2, flat, &avg, &std);
 
-              /*  Compute the eight slopes from the center cell to find out if it's flat enough to use the average
-                  of the standard deviations or if we need to use the standard deviation of the averages.  We use a
-                  reference slope of 1 degree to determine which we need to use.  */
+  filter_points (args, c, avg, std);
+}
 
-              flat = NVTrue;
-              for (i = n - 1 ; i <= n + 1 ; i++)
-                {
-                  for (j = m - 1 ; j <= m + 1 ; j++)
-                    {
-                      /*  Make sure each cell is in the area (edge effect).  */
-
-                      if (i >= 0 && i < height && j >= 0 && j < width)
-                        {
-                          /*  Don't use the center cell.  */
-
-                          if (i != n || j != m)
-                            {
-                              if (grid[i][j].count && ! grid[i][j].cleared)
-                                {
-                                  slope = (fabs (grid[n][m].avg - grid[i][j].avg)) / dx;
-                      
-                                  if (slope > 1.0)
-                                    {
-                                      flat = NVFalse;
-                                      break;
-                                    }
-                                }
-                            }
-                        }
-                    }
-                }
 
 
-              /*  If the slope is low (< 1 degree) we'll use an average of the cell standard deviations to beat the
-                  depths against.  Otherwise, we'll compute the standard deviation from the cell averages.  Since we're
-                  using the average of the computed standard deviations of all of the nine cells or the standard
-                  deviations of the averages of all nine cells we multiply the resulting standard deviation (?) by two
-                  to get a reasonable result, otherwise the standard deviation surface is too smooth and we end up
-                  cutting out too much good data.  I must admit I arrived at these numbers by playing with the filter
-                  using em3000 shallow water data and em121a deep water data but they appear to work properly.  This
-                  way three sigma seems to cut out what you would expect three sigma to cut out.  If you leave it as is
-                  it cuts out about 30%.  This is called empirically determining a value (From Nero's famous statement
-                  "I'm the emperor and I can do what I damn well please, now hand me my fiddle.").   JCD  */
+/*  Filter one tile of the current wave.  The tile's cells are in raster order.  */
 
-              avg = avgsum / (double) sumcount; 
-              if (flat || sumcount < 2)
-                {
-                  std = (stdsum / (double) sumcount) * 2.0;
-                }
-              else
-                {
-                  std = (sqrt ((sum2 - ((double) sumcount * (avg * avg))) / ((double) sumcount - 1.0))) * 2.0;
-                }
+static void filter_tile (void *arg, int32_t task)
+{
+  FILTER_ARGS *args = (FILTER_ARGS *) arg;
+  GRID *grid = args->grid;
+  int32_t tile, i;
 
-              sigma_filter = std_env * std;
 
+  tile = args->first_tile + task;
 
-              recompflag = NVFalse;
-              for (i = 0 ; i < grid[n][m].count ; i++)
-                {
-                  grid[n][m].depths[i].filtered = NVFalse;
+  for (i = grid->tile_start[tile] ; i < grid->tile_start[tile + 1] ; i++) filter_cell (args, grid->order[i]);
+}
 
 
-                  /*  Check for deep filter only.  */
 
-                  if (deep)
-                    {
-                      if (adep[grid[n][m].depths[i].index] - avg >= sigma_filter) 
-                        {
-                          grid[n][m].depths[i].filtered = NVTrue;
-                          recompflag = NVTrue;
-                        }
-                    }
-                  else
-                    {
-                      if (fabs (adep[grid[n][m].depths[i].index] - avg) >= sigma_filter)
-                        {
-                          grid[n][m].depths[i].filtered = NVTrue;
-                          recompflag = NVTrue;
-                        }
-                    }
-                }
+/*  Take the snapshot of the cell statistics for one block of cells of the Jacobi sweep.  */
 
+static void jacobi_snapshot (void *arg, int32_t task)
+{
+  FILTER_ARGS *args = (FILTER_ARGS *) arg;
+  GRID *grid = args->grid;
+  int32_t c, c_end;
 
-              if (recompflag)
-                {
-                  sum_filtered = 0.0;
-                  sum2_filtered = 0.0;
-                  filtered_count = 0;
 
+  c_end = MIN ((task + 1) * JACOBI_CELLS, grid->cells);
 
-                  for (i = 0 ; i < grid[n][m].count ; i++)
-                    {
-                      if (!(grid[n][m].depths[i].filtered))
-                        {
-                          sum_filtered += adep[grid[n][m].depths[i].index];
-                          sum2_filtered += (adep[grid[n][m].depths[i].index] * adep[grid[n][m].depths[i].index]);
+  for (c = task * JACOBI_CELLS ; c < c_end ; c++)
+    {
+      grid->snap_avg[c] = grid->avg[c];
+      grid->snap_std[c] = grid->std[c];
+      grid->snap_active[c] = !grid->cleared[c];
+    }
+}
 
-                          filtered_count++;
-                        }
-                    }
 
 
-                  if (!filtered_count)
-                    {
-                      grid[n][m].cleared = NVTrue;
-                    }
-                  else
+/*  Filter one block of cells of the Jacobi sweep (or of the worklist for a pass after the first).  Each cell reads
+    its neighborhood from the snapshot.  The terms are added in the same order as in filter_cell so if the
+    snapshot matches what filter_cell would see we get exactly the same sums.  This only writes the live cell
+    statistics, never the snapshot, so the cells are independent of each other.  */
+
+static void jacobi_cells (void *arg, int32_t task)
+{
+  FILTER_ARGS *args = (FILTER_ARGS *) arg;
+  GRID *grid = args->grid;
+  int32_t i, i_end, c, k, nc, sumcount, *neighbor;
+  double avgsum, stdsum, sum2, avg, std;
+  uint8_t steep;
+  float center;
+
+
+  i_end = MIN ((task + 1) * JACOBI_CELLS, (args->work == NULL) ? grid->cells : args->work_count);
+
+  for (i = task * JACOBI_CELLS ; i < i_end ; i++)
+    {
+      c = (args->work == NULL) ? i : args->work[i];
+
+      neighbor = &grid->neighbor[c * 9];
+      center = grid->snap_avg[c];
+
+      avgsum = stdsum = sum2 = 0.0;
+      sumcount = 0;
+      steep = NVFalse;
+
+      for (k = 0 ; k < 9 ; k++)
+        {
+          nc = neighbor[k];
+
+          if (nc >= 0 && grid->snap_active[nc])
+            {
+              avgsum += grid->snap_avg[nc];
+              stdsum += grid->snap_std[nc];
+              sum2 += grid->snap_avg[nc] * grid->snap_avg[nc];
+              sumcount++;
+
+              if (k != 4 && (fabsf (center - grid->snap_avg[nc])) / args->dx > 1.0) steep = NVTrue;
+            }
+        }
+
+      composite_stats (sumcount, avgsum, stdsum, sum2, !steep, &avg, &std);
+
+      if (args->work == NULL)
+        {
+          filter_points (args, c, avg, std);
+        }
+      else
+        {
+          refilter_points (args, c, avg, std);
+        }
+    }
+}
+
+
+
+/*  Filter one block of cells (or of the worklist) using the window sums for a neighborhood wider than 3 by 3 (see
+    window.c).  The composite statistics are worked out the same way as in composite_stats but from sums with the
+    window's ref taken off the averages.  Looking at every neighbor for the slope test would cost radius squared
+    per cell so we use the same sums for that too.  We take the RMS of the differences between the neighbor
+    averages and this cell's average.  On a uniform slope of s per cell across a full window that comes to
+    s * (2 * radius + 1) / sqrt (12), whatever the size of the window, so comparing it with dx times that factor
+    calls the neighborhood steep at the same slope as the 3 by 3 test (exactly, for a slope along the rows or
+    the columns).  */
+
+static void window_cells (void *arg, int32_t task)
+{
+  FILTER_ARGS *args = (FILTER_ARGS *) arg;
+  GRID *grid = args->grid;
+  WINDOW *window = &grid->window;
+  int32_t i, i_end, c, n;
+  double mean, d, dev2, var, avg, std;
+
+
+  i_end = MIN ((task + 1) * JACOBI_CELLS, (args->work == NULL) ? grid->cells : args->work_count);
+
+  for (i = task * JACOBI_CELLS ; i < i_end ; i++)
+    {
+      c = (args->work == NULL) ? i : args->work[i];
+
+      n = window->count[c];
+      if (!n) continue;
+
+      mean = window->sum[c] / (double) n;
+      avg = mean + window->ref;
+
+
+      /*  Sum of the squared differences from this cell's average.  */
+
+      d = (double) grid->snap_avg[c] - window->ref;
+      dev2 = window->sum2[c] - 2.0 * d * window->sum[c] + (double) n * d * d;
+
+      if (n < 2 || sqrt (MAX (dev2, 0.0) / ((double) n - 1.0)) /
+          (args->dx * (double) (2 * window->radius + 1) / sqrt (12.0)) <= 1.0)
+        {
+          std = (window->sum_std[c] / (double) n) * 2.0;
+        }
+      else
+        {
+          var = (window->sum2[c] - (double) n * mean * mean) / ((double) n - 1.0);
+          std = sqrt (MAX (var, 0.0)) * 2.0;
+        }
+
+      if (args->work == NULL)
+        {
+          filter_points (args, c, avg, std);
+        }
+      else
+        {
+          refilter_points (args, c, avg, std);
+        }
+    }
+}
+
+
+
+/*  Make more passes over the grid until nothing changes or we've made params->passes of them.  A cell's composite
+    statistics only change if its own statistics or one of its neighbors' changed in the last pass so those are
+    the only cells we filter again.  Each pass is a Jacobi pass over the worklist (every cell sees its
+    neighborhood as it was at the end of the last pass) so the cells can be done in any order and the answer is
+    the same for any number of threads.  Points only ever get filtered, never unfiltered, so this always stops.  */
+
+static void iterate (FILTER_ARGS *args, FILTER_PARAMS *params)
+{
+  GRID *grid = args->grid;
+  int32_t c, i, k, nc, changed_count;
+
+
+  /*  Snapshot the whole grid as the first pass left it and list the cells that changed.  */
+
+  thread_pool_run (params->pool, jacobi_snapshot, args, (grid->cells + JACOBI_CELLS - 1) / JACOBI_CELLS);
+
+  changed_count = 0;
+  for (c = 0 ; c < grid->cells ; c++)
+    {
+      if (grid->changed[c]) grid->next[changed_count++] = c;
+    }
+
+
+  args->work = grid->work;
+
+  while (changed_count && grid->passes < params->passes)
+    {
+      args->work_count = 0;
+
+
+      /*  For a wider neighborhood bring the snapshot up to date, redo the window sums (which also counts the cells
+          that changed in each window), and filter again every cell with a changed cell in its window.  */
+
+      if (params->radius > 1)
+        {
+          for (i = 0 ; i < changed_count ; i++)
+            {
+              c = grid->next[i];
+
+              grid->snap_avg[c] = grid->avg[c];
+              grid->snap_std[c] = grid->std[c];
+              grid->snap_active[c] = !grid->cleared[c];
+            }
+
+          window_sums (grid);
+
+          for (i = 0 ; i < changed_count ; i++) grid->changed[grid->next[i]] = NVFalse;
+
+          for (c = 0 ; c < grid->cells ; c++)
+            {
+              if (grid->window.changed[c] && !grid->cleared[c]) grid->work[args->work_count++] = c;
+            }
+
+          thread_pool_run (params->pool, window_cells, args, (args->work_count + JACOBI_CELLS - 1) / JACOBI_CELLS);
+        }
+
+
+      /*  Otherwise bring the snapshot up to date for the cells that changed in the last pass and build the
+          worklist from them and their neighbors.  The worklist is in no particular order.  */
+
+      else
+        {
+          for (i = 0 ; i < changed_count ; i++)
+            {
+              c = grid->next[i];
+
+              grid->changed[c] = NVFalse;
+              grid->snap_avg[c] = grid->avg[c];
+              grid->snap_std[c] = grid->std[c];
+              grid->snap_active[c] = !grid->cleared[c];
+
+              for (k = 0 ; k < 9 ; k++)
+                {
+                  nc = grid->neighbor[c * 9 + k];
+
+                  if (nc >= 0 && !grid->mark[nc] && !grid->cleared[nc])
                     {
-                      grid[n][m].avg = sum_filtered / (double) filtered_count; 
-                      if (filtered_count > 1)
-                        {
-                          grid[n][m].std = sqrt ((sum2_filtered - ((double) filtered_count * 
-                                                                   (pow ((double) grid[n][m].avg, 2.0)))) / 
-                                                 ((double) filtered_count - 1.0));
-                        }
-                      else
-                        {
-                          grid[n][m].std = 0.0;
-                        }
+                      grid->mark[nc] = NVTrue;
+                      grid->work[args->work_count++] = nc;
                     }
                 }
             }
+
+          for (i = 0 ; i < args->work_count ; i++) grid->mark[grid->work[i]] = NVFalse;
+
+
+          thread_pool_run (params->pool, jacobi_cells, args, (args->work_count + JACOBI_CELLS - 1) / JACOBI_CELLS);
+        }
+
+      grid->passes++;
+      grid->touched += args->work_count;
+
+
+      changed_count = 0;
+      for (i = 0 ; i < args->work_count ; i++)
+        {
+          if (grid->changed[grid->work[i]]) grid->next[changed_count++] = grid->work[i];
+        }
+    }
+}
+
+
+
+/*  Filter the grid.  Each cell sees the updated statistics of the cells before it in raster order (the whole
+    previous row and the cell to its left) and the original statistics of the cells after it.  To run this in
+    parallel without changing the answer we use column u = n + m instead of m.  In n, u space every cell only
+    depends on cells at the same or lower n and u, and it reads the cells at the same or higher n and u before
+    they are updated.  So we cut the n, u plane into rectangular tiles, do each tile in raster order, and run
+    the tiles as a wavefront.  Tile ti, tj goes in wave ti + tj, and all of the tiles in a wave can run at the
+    same time.  The result is bit for bit the same as the serial sweep for any number of threads.  grid_build
+    works out which cells are in which tile (only tiles with cells in them exist) and which tiles are in which
+    wave.
+
+    If params->jacobi is set we do a Jacobi style sweep instead.  Every cell reads its neighbors' statistics from
+    a snapshot taken before the sweep and writes its updated statistics to the live grid.  No cell depends on any
+    other so the cells can be done in any order.  The filtered flags will differ a little from the raster sweep
+    since later cells no longer see the cleaned up statistics of earlier cells.
+
+    If params->radius is more than 1 the neighborhood is 2 * radius + 1 cells on a side instead of 3 and we work
+    from the snapshot like the Jacobi sweep, using sliding window sums so the cost per cell doesn't depend on the
+    radius (see window.c and window_cells).
+
+    Either way a cell only sees the changes to the cells filtered before it so some outliers survive that another
+    pass would catch.  If params->passes is more than 1 we keep going (see iterate).  */
+
+void gsf_filter (GRID *grid, double dx, FILTER_PARAMS *params)
+{
+  int32_t c, wave, blocks;
+  FILTER_ARGS args;
+  THREAD_POOL *pool = params->pool;
+
+
+  args.grid = grid;
+  args.dx = dx;
+  args.std_env = params->std_env;
+  args.test = cell_test[params->deep ? 1 : 0];
+  args.work = NULL;
+  args.work_count = 0;
+
+  grid->passes = 1;
+  grid->touched = 0;
+
+  if (params->passes > 1) memset (grid->changed, 0, grid->cells);
+
+
+  /*  A neighborhood wider than 3 by 3 always works from the snapshot (see window.c).  */
+
+  if (params->radius > 1)
+    {
+      blocks = (grid->cells + JACOBI_CELLS - 1) / JACOBI_CELLS;
+
+      thread_pool_run (pool, jacobi_snapshot, &args, blocks);
+      window_sums (grid);
+      thread_pool_run (pool, window_cells, &args, blocks);
+    }
+
+  else if (params->jacobi)
+    {
+      blocks = (grid->cells + JACOBI_CELLS - 1) / JACOBI_CELLS;
+
+      thread_pool_run (pool, jacobi_snapshot, &args, blocks);
+      thread_pool_run (pool, jacobi_cells, &args, blocks);
+    }
+
+
+  /*  Single threaded (or no tile order), just loop through the cells in raster order and filter the data.  */
+
+  else if (pool == NULL || !pool->threads || grid->order == NULL)
+    {
+      for (c = 0 ; c < grid->cells ; c++) filter_cell (&args, c);
+    }
+
+  else
+    {
+      for (wave = 0 ; wave < grid->waves ; wave++)
+        {
+          args.first_tile = grid->wave_start[wave];
+
+          thread_pool_run (pool, filter_tile, &args, grid->wave_start[wave + 1] - grid->wave_start[wave]);
         }
     }
+
+
+  if (params->passes > 1) iterate (&args, params);
 }
@@ -25,34 +25,619 @@
 #define __GSF_FILTER_H__
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <getopt.h>
 #include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <setjmp.h>
 
 #include "nvutility.h"
 
 #include "gsf.h"
 
 
+#ifndef MIN
+  #define MIN(a, b)  (((a) < (b)) ? (a) : (b))
+#endif
+
+#ifndef MAX
+  #define MAX(a, b)  (((a) > (b)) ? (a) : (b))
+#endif
+
+
+/*  Window sums for neighborhoods wider than 3 by 3 (see window.c).  For each cell, count is the number of active
+    cells in the window around it, changed the number of those that changed in the last pass, and sum, sum_std,
+    and sum2 are the sums of their averages less ref, standard deviations, and squared averages less ref.  rows
+    and row_start are the grid rows that have cells and their first cells, and lo, hi, and prefix are work space.
+    All of them are sized by the number of cells, not by the grid.  */
+
+typedef struct
+{
+  int32_t             radius;
+  double              ref;
+  int32_t             *rows;
+  int32_t             *row_start;
+  int32_t             *lo;
+  int32_t             *hi;
+  double              *prefix;
+  int32_t             *count;
+  int32_t             *changed;
+  double              *sum;
+  double              *sum_std;
+  double              *sum2;
+} WINDOW;
+
+
+/*  The page grid (see grid.c).  Only the cells with points are stored, in raster order, as a structure of arrays.
+    Cell c is at row[c], col[c] of the height by width grid and neighbor[c * 9] through neighbor[c * 9 + 8] are the
+    cells of its 3 by 3 neighborhood in raster order (including itself), or -1 for empty or off the grid.  The
+    points in a cell occupy index[start] through index[start + count - 1] (and the matching depth and filtered
+    entries) so each cell's points are contiguous.  Depth is a copy of the point depths in cell order so the per
+    cell loops don't have to gather through index.  Order, tile_start, and wave_start give the cells of each tile
+    and the tiles of each wave for the multithreaded sweep, the snap_ arrays are only used by the Jacobi filter
+    and by the passes after the first, and changed, work, next, and mark are only used for the passes after the
+    first (see gsf_filter.c).  All of the arrays come from the page arena.  passes and touched are set by
+    gsf_filter to the number of passes it made and the number of cells it filtered again after the first.  window
+    is only used for neighborhoods wider than 3 by 3.  */
+
+typedef struct
+{
+  int32_t             cells;
+  int32_t             height;
+  int32_t             width;
+  int32_t             *row;
+  int32_t             *col;
+  int32_t             *neighbor;
+  float               *avg;
+  float               *std;
+  int32_t             *count;
+  int32_t             *start;
+  uint8_t             *cleared;
+  int32_t             *index;
+  float               *depth;
+  uint8_t             *filtered;
+  int32_t             tiles;
+  int32_t             waves;
+  int32_t             *order;
+  int32_t             *tile_start;
+  int32_t             *wave_start;
+  float               *snap_avg;
+  float               *snap_std;
+  uint8_t             *snap_active;
+  uint8_t             *changed;
+  int32_t             *work;
+  int32_t             *next;
+  uint8_t             *mark;
+  int32_t             passes;
+  int32_t             touched;
+  WINDOW              window;
+} GRID;
+
+
+/*  Size and shape of a grid (see grid_layout).  */
+
+typedef struct
+{
+  double              grid_size;            /*  Cell size in degrees of latitude  */
+  double              cell_size;            /*  Cell size in the units of the coordinates  */
+  double              dx;                   /*  Cell diagonal in meters  */
+  int32_t             height;
+  int32_t             width;
+  int32_t             coarsened;            /*  Number of times the cell size was doubled to fit in 32 bits  */
+} GRID_LAYOUT;
+
+
+/*  Tile size for the multithreaded sweep.  Tiles are TILE_ROWS rows by TILE_COLS cells of skewed column (row plus
+    column, see gsf_filter.c).  */
+
+#define TILE_ROWS             32
+#define TILE_COLS             128
+
+
+/*  Page memory arena.  Memory is handed out sequentially from one large block and is only released as a whole
+    by arena_reset.  If the block fills up during a page we chain overflow blocks onto it and, on the next reset,
+    replace everything with a single block large enough for the whole page.  Once the arena has seen the largest
+    page we never call malloc or free again.  Running out of memory is fatal unless fail is set, in which case
+    arena_alloc jumps back to it instead (see engine.c).  */
+
+typedef struct
+{
+  uint8_t             *block;
+  size_t              size;
+  size_t              used;
+  size_t              high_water;           /*  Total bytes handed out since the last reset  */
+  uint8_t             **overflow;
+  int32_t             overflow_count;
+  jmp_buf             *fail;                /*  Where to go when malloc fails, normally NULL (exit)  */
+} ARENA;
+
+
+/*  Structure of arrays point buffer.  Capacity doubles when it fills and the buffer is kept for the life of the
+    run, so after the first few pages we don't reallocate at all.  */
+
+typedef struct
+{
+  int32_t             size;
+  double              *lat;
+  double              *lon;
+  float               *dep;
+  int32_t             *ping;
+  int16_t             *beam;
+} POINT_BUF;
+
+
+/*  Fork/join thread pool.  thread_pool_run runs func (arg, task) for task = 0 through tasks - 1 and returns when
+    all of them are done.  The calling thread works on its own batch too, and several threads may call
+    thread_pool_run on the same pool at the same time.  */
+
+typedef void (*THREAD_TASK) (void *arg, int32_t task);
+
+
+typedef struct POOL_BATCH
+{
+  THREAD_TASK         func;
+  void                *arg;
+  int32_t             tasks;
+  int32_t             next;
+  int32_t             done;
+  struct POOL_BATCH   *link;
+} POOL_BATCH;
+
+
+typedef struct
+{
+  int32_t             threads;              /*  Number of worker threads (not counting callers)  */
+  pthread_t           *thread;
+  pthread_mutex_t     mutex;
+  pthread_cond_t      work;
+  pthread_cond_t      finished;
+  POOL_BATCH          *batches;
+  uint8_t             shutdown;
+} THREAD_POOL;
+
+
+/*  Filter options.  */
+
+typedef struct
+{
+  float               std_env;              /*  Number of standard deviations to filter  */
+  uint8_t             deep;                 /*  Only filter in the downward direction  */
+  uint8_t             jacobi;               /*  Use frozen neighbor statistics (see gsf_filter.c)  */
+  int32_t             passes;               /*  Maximum number of passes, 1 (or 0) for the single sweep  */
+  int32_t             radius;               /*  Neighborhood radius in cells, 1 (or 0) for 3 by 3  */
+  THREAD_POOL         *pool;                /*  NULL to run single threaded  */
+} FILTER_PARAMS;
+
+
+/*  Number of pings in a page.  */
+
+#define PINGS_PER_PAGE        1000
+
+
+/*  What each stage did with a page and how long it took, for --profile and the benchmark.  The times are only
+    filled in if PIPELINE timing is set.  coarsened is the number of times the grid size had to be doubled to keep
+    the row and column numbers in 32 bits.  */
+
 typedef struct
 {
-  int32_t             index;
-  uint8_t             filtered;
-} DEPTH_REC;
+  double              decode;
+  double              georef;
+  double              bin;
+  double              stats;
+  double              filter;
+  double              write;
+  double              grid_size;            /*  Final grid size in degrees  */
+  int32_t             soundings;            /*  Valid beams in the page (not counting the halo)  */
+  int32_t             grid_height;
+  int32_t             grid_width;
+  int32_t             coarsened;
+  int32_t             cells;                /*  Occupied cells  */
+  int32_t             filtered;             /*  Soundings filtered in the page  */
+  int32_t             rewritten;            /*  Pings written back  */
+  int32_t             passes;               /*  Filter passes made  */
+  int32_t             touched;              /*  Cells filtered again after the first pass  */
+} PAGE_PROFILE;
+
 
+/*  One page of pings.  The reader fills ping_rec with copies of the valid pings (valid is set for those slots),
+    the worker sets the filter flags in the copies and marks the pings it changed as dirty, and the writer writes
+    the dirty pings back to the file.  Slot i holds record page_start + i.  mapped is set for the pings that were
+    decoded from the memory map, which only have the fields the filter needs in them (see gsf_map.c).
+    flag_offset is where the ping's beam flags are in the file if they can be patched in place (0 if not) and
+    dirty_lo and dirty_hi are the first and last beams the worker flagged.  */
 
 typedef struct
 {
-  float               avg;
-  float               std;
-  uint8_t             cleared;
+  int32_t             page_start;           /*  Record number of the first ping in the page  */
+  int32_t             pings;                /*  Number of records read for the page  */
+  int32_t             percent;              /*  Percent of the file read when the page was finished  */
+  uint8_t             last;                 /*  Set for the last page of the file  */
+  uint8_t             jump;                 /*  Set if the page was cut short by a position jump  */
+  uint8_t             *valid;
+  uint8_t             *dirty;
+  uint8_t             *mapped;
+  size_t              *flag_offset;
+  int32_t             *dirty_lo;
+  int32_t             *dirty_hi;
+  double              start_lat;            /*  Reader state before and after the page, for the checkpoints  */
+  double              start_lon;
+  int32_t             next_rec;
+  double              end_lat;
+  double              end_lon;
+  PAGE_PROFILE        profile;
+  gsfRecords          *ping_rec;
+} PAGE;
+
+
+/*  The number of beams is stored in 16 bits in the sidecar and checkpoint files.  */
+
+#define MAX_SIDECAR_BEAMS     65535
+
+
+/*  Room for the filter options in the history record comment and the sidecar header (see filter_options).  */
+
+#define FILTER_OPTIONS        256
+
+
+/*  Where to pick up a file that was stopped (see checkpoint.c).  page_start is 0 if we're starting at the
+    beginning.  */
+
+typedef struct
+{
+  int32_t             page_start;           /*  Last page that was written  */
+  double              start_lat;            /*  Last position the reader saw before it  */
+  double              start_lon;
+  uint8_t             jump;                 /*  Set if it was cut short by a position jump  */
+  int32_t             next_rec;             /*  First record of the next page  */
+  double              lat;                  /*  Last position the reader saw  */
+  double              lon;
+  uint64_t            checksum;             /*  Of the last page's flags  */
+} CHECKPOINT;
+
+
+/*  Bounded page queue.  page_queue_put blocks while the queue is full and page_queue_get blocks while it is
+    empty.  */
+
+typedef struct
+{
+  PAGE                **page;
+  int32_t             size;
+  int32_t             head;
   int32_t             count;
-  DEPTH_REC           *depths;
-} GRID_REC;
+  pthread_mutex_t     mutex;
+  pthread_cond_t      not_empty;
+  pthread_cond_t      not_full;
+} PAGE_QUEUE;
+
+
+/*  Memory mapped GSF file for --fast_read (see gsf_map.c).  base is NULL if the file isn't mapped.  */
+
+typedef struct
+{
+  uint8_t             *base;
+  size_t              size;
+  size_t              first;                /*  Offset of the first record after the header  */
+  size_t              ping_bytes;           /*  Size of the first ping record  */
+  size_t              offset;               /*  Offset of the next record  */
+  int32_t             next_ping;            /*  Number of the next ping record (starting at 1)  */
+  gsfScaleFactors     scale;                /*  Scale factors in effect at offset  */
+  size_t              last_offset;          /*  Offset, number, and scale factors of the last ping read  */
+  int32_t             last_ping;
+  gsfScaleFactors     last_scale;
+  size_t              flag_offset;          /*  Beam flags of the last ping read, 0 if they can't be patched  */
+  uint8_t             checksum;             /*  Set if the last ping read has a checksum  */
+} GSF_MAP;
+
+
+/*  Seconds spent in each stage and the number of pings and soundings that went through them (see bench/).  The
+    writer adds each page's profile to these when it's done with the page.  */
+
+typedef struct
+{
+  double              decode;               /*  Reading and decoding the pings  */
+  double              georef;               /*  Positioning the beams  */
+  double              bin;                  /*  Sizing the grid and putting the points in it  */
+  double              stats;                /*  Cell averages and standard deviations  */
+  double              filter;               /*  gsf_filter and setting the flags  */
+  double              write;                /*  Writing the changed pings  */
+  double              history;              /*  Writing the history record  */
+  int64_t             pings;
+  int64_t             soundings;
+} STAGE_TIMES;
+
+
+/*  Everything we need to filter one file.  The reader, worker, and writer state are only ever touched by the
+    stage that owns them so the stages don't need to lock anything but the GSF library (see pipeline.c).  The
+    writer reports its progress to the batch the file belongs to.  */
+
+typedef struct
+{
+  char                *file;
+  int32_t             read_hnd;             /*  Same as write_hnd when depth is 0  */
+  int32_t             write_hnd;            /*  -1 until it's needed with --fast_read (see gsf_write_hnd)  */
+  int32_t             page_size;
+  int32_t             depth;                /*  Pages queued between stages, 0 to run the stages in sequence  */
+  int32_t             halo;                 /*  Pings from the neighboring pages to grid with each page  */
+  uint8_t             rotate;               /*  Grid in a frame rotated to the page's mean heading  */
+  FILTER_PARAMS       params;
+  uint8_t             jacobi_check;
+  uint8_t             fast_georef;          /*  Use the local tangent plane instead of newgp (see georef.c)  */
+  uint8_t             georef_check;         /*  Also run newgp and keep track of the largest difference  */
+  STAGE_TIMES         *times;               /*  Per stage timing for the benchmark, normally NULL  */
+  FILE                *profile;             /*  --profile JSON lines file, normally NULL  */
+  uint8_t             timing;               /*  Set if times or profile is set  */
+  uint8_t             sidecar;              /*  Write the flags to a sidecar file instead of the GSF file  */
+  uint8_t             checkpoint;           /*  Write checkpoints (always, unless writing a sidecar)  */
+  uint8_t             resume;               /*  Pick up from the checkpoint if there is one  */
+  uint8_t             fast_read;            /*  Read the pings through a memory map and patch the flags in place  */
+  uint8_t             fast_read_check;      /*  Also read them with gsfRead and compare  */
+
+
+  /*  Reader state.  */
+
+  int32_t             start_rec;
+  double              prev_lat;
+  double              prev_lon;
+  CHECKPOINT          resume_from;
+  GSF_MAP             map;
+  int32_t             map_checked;          /*  Pings compared by fast_read_check  */
+  int32_t             map_differ;           /*  Pings that weren't the same  */
+  int32_t             map_checksums;        /*  Pings read through the map that have a checksum  */
+
+
+  /*  Worker state.  */
+
+  POINT_BUF           points;
+  ARENA               arena;
+  int32_t             classic_total;
+  int32_t             jacobi_only;
+  int32_t             classic_only;
+  double              *beam_lat;            /*  Fast georeferencing results for one ping  */
+  double              *beam_lon;
+  int32_t             beam_size;
+  double              georef_max;           /*  Largest georef_check difference in meters  */
+  int32_t             max_passes;           /*  Most passes any page took  */
+  int64_t             touched;              /*  Cells filtered again after the first pass, for the whole file  */
+
+
+  /*  Writer state.  */
+
+  struct BATCH        *batch;
+  int32_t             file_num;
+  int32_t             patch_fd;             /*  For patching the beam flags in place (--fast_read), else -1  */
+  FILE                *sidecar_fp;          /*  See sidecar.c  */
+  int32_t             sidecar_pings;
+} PIPELINE;
+
+
+/*  A batch of files to filter (see batch.c).  Up to "jobs" files are filtered at the same time, all of them
+    sharing the filter thread pool.  A file isn't started until its estimated memory use fits in what's left of
+    the memory budget (unless nothing else is running).  options holds the filter settings that are copied into
+    each file's pipeline.  */
+
+typedef struct BATCH
+{
+  int32_t             argc;                 /*  Program name and options for the history records  */
+  char                **argv;
+  int32_t             files;
+  char                **file;
+  double              *size;                /*  File sizes in bytes, for the overall progress  */
+  int32_t             *percent;             /*  Percent processed for each file  */
+  int32_t             jobs;
+  double              memory;               /*  Memory budget in bytes, 0 for no limit  */
+  uint8_t             apply;                /*  Apply the sidecar files instead of filtering  */
+  uint8_t             survey;               /*  Filter all of the files together in tiles (see survey.c)  */
+  double              tile_size;            /*  Survey tile size in meters  */
+  char                *tile_dir;            /*  Where the tile cache spills to  */
+  PIPELINE            options;
+  pthread_mutex_t     mutex;
+  pthread_cond_t      memory_free;
+  int32_t             next;                 /*  Next file to start  */
+  int32_t             done;                 /*  Number of files finished  */
+  int32_t             running;              /*  Number of files being filtered  */
+  double              reserved;             /*  Memory reserved by the running files  */
+  int32_t             old_percent;
+} BATCH;
+
+
+/*  One georeferenced sounding of a survey and where it came from (see survey.c).  beams is the number of beams
+    in its ping, for the sidecar file.  */
+
+typedef struct
+{
+  double              lat;
+  double              lon;
+  float               dep;
+  int32_t             file;                 /*  File number in the batch  */
+  int32_t             ping;                 /*  Record number  */
+  uint16_t            beam;
+  uint16_t            beams;
+  uint8_t             filtered;             /*  Flagged when its tile was filtered  */
+} SOUNDING;
+
+
+/*  One survey tile.  The first on_disk soundings of the tile were spilled to the cache file in chunks of
+    chunk_count soundings at chunk_offset.  data holds used soundings starting with sounding number first (0 once
+    the whole tile has been loaded back, on_disk while it's being added to).  Tiles with data in memory are on the
+    least recently used list (prev and next, -1 at the ends) and pinned tiles are never spilled.  dirty is set
+    when the tile has been filtered since it was loaded, so the chunks already on disk have to be written again.  */
+
+typedef struct
+{
+  int32_t             row;                  /*  Tile row and column counted from 0 degrees  */
+  int32_t             col;
+  int32_t             count;                /*  All of the soundings, in memory and spilled  */
+  SOUNDING            *data;
+  int32_t             first;
+  int32_t             used;
+  int32_t             size;
+  int64_t             *chunk_offset;
+  int32_t             *chunk_count;
+  int32_t             chunks;
+  int32_t             on_disk;
+  int32_t             prev;
+  int32_t             next;
+  uint8_t             pinned;
+  uint8_t             dirty;
+} TILE;
+
+
+/*  Survey tile cache.  Tiles are found by row and column through an open addressing hash table of tile numbers
+    (-1 for empty).  memory is the bytes of soundings held in memory and when it goes over budget the least
+    recently used tiles are appended to the spill file.  */
+
+typedef struct
+{
+  double              tile_deg;             /*  Tile size in degrees  */
+  TILE                *tile;
+  int32_t             tiles;
+  int32_t             tile_size;            /*  Room in tile  */
+  int32_t             *table;
+  int32_t             table_size;           /*  Power of 2  */
+  int32_t             lru_head;             /*  Most recently used  */
+  int32_t             lru_tail;
+  double              memory;
+  double              budget;
+  char                spill_name[2048];
+  FILE                *spill_fp;
+  int64_t             spill_end;
+  int64_t             spilled;              /*  Soundings written to the spill file  */
+  int64_t             reloaded;             /*  Soundings read back from it  */
+} TILE_CACHE;
+
+
+/*  The beams of one file that the survey filter flagged.  The ones in flag haven't been spilled yet, the rest are
+    in sorted runs of run_count flags at run_offset in the flag spill file.  */
+
+typedef struct
+{
+  int32_t             ping;
+  uint16_t            beam;
+  uint16_t            beams;
+} SURVEY_FLAG;
+
+typedef struct
+{
+  SURVEY_FLAG         *flag;
+  int32_t             count;
+  int32_t             size;
+  int64_t             *run_offset;
+  int32_t             *run_count;
+  int32_t             runs;
+} SURVEY_FLAGS;
+
+
+/*  The flag lists of all of the files in a survey.  memory is the bytes held by the lists and when it goes over
+    budget every list is sorted and appended to the spill file as a run.  */
+
+typedef struct
+{
+  SURVEY_FLAGS        *file;                /*  One list per file in the batch  */
+  double              memory;
+  double              budget;
+  char                spill_name[2048];
+  FILE                *spill_fp;
+  int64_t             spill_end;
+  int64_t             spilled;              /*  Flags written to the spill file  */
+} FLAG_CACHE;
+
+
+/*  Local tangent plane frame for georeferencing the beams of one ping (see georef.c).  */
+
+typedef struct
+{
+  double              lat;                  /*  Ping position in degrees  */
+  double              lon;
+  double              across_x;             /*  East and north components of the across track direction  */
+  double              across_y;
+  double              along_x;              /*  East and north components of the along track direction  */
+  double              along_y;
+  double              ky;                   /*  Degrees of latitude per meter north  */
+  double              kx;                   /*  Degrees of longitude per meter east  */
+  double              kxx;                  /*  Second order coefficients  */
+  double              kyy;
+  double              kxy;
+  double              kty;
+} LTP_FRAME;
+
+
+/*  Per cell kernels (see simd.c).  cell_sums adds up the depths and squared depths of a cell (skipping the
+    filtered points if filtered isn't NULL).  cell_test sets the filtered flag for each depth that is sigma_filter
+    or more from avg (or, for cell_test[NVTrue], sigma_filter or more deeper than avg) and returns the number of
+    points filtered.  */
+
+typedef void (*CELL_SUMS) (const float *dep, const uint8_t *filtered, int32_t count, double *sum, double *sum2);
+typedef int32_t (*CELL_TEST) (const float *dep, int32_t count, double avg, double sigma_filter, uint8_t *filtered);
+
+extern CELL_SUMS cell_sums;
+extern CELL_TEST cell_test[2];
 
 
-void gsf_filter (GRID_REC **grid, int32_t height, int32_t width, float *adep, double dx,
-                 float std_env, uint8_t deep);
+void *arena_alloc (ARENA *arena, size_t bytes);
+void arena_reset (ARENA *arena);
+void arena_free (ARENA *arena);
+void point_buf_grow (POINT_BUF *points, int32_t needed);
+void point_buf_free (POINT_BUF *points);
+int32_t cpu_count ();
+THREAD_POOL *thread_pool_create (int32_t threads);
+void thread_pool_run (THREAD_POOL *pool, THREAD_TASK func, void *arg, int32_t tasks);
+void thread_pool_destroy (THREAD_POOL *pool);
+PAGE *page_alloc (int32_t page_size);
+void page_free (PAGE *page, int32_t page_size);
+void read_page (PIPELINE *pipeline, PAGE *page);
+void filter_page (PIPELINE *pipeline, PAGE *prev, PAGE *page, PAGE *next);
+int32_t page_points (PIPELINE *pipeline, PAGE *page);
+void write_page (PIPELINE *pipeline, PAGE *page);
+int32_t gsf_write_hnd (PIPELINE *pipeline);
+void ltp_frame (double lat, double lon, double heading, LTP_FRAME *frame);
+void ltp_beams (const LTP_FRAME *frame, const double *across, const double *along, int32_t beams, double *lat,
+                double *lon);
+void gsf_lock ();
+void gsf_unlock ();
+double stage_clock ();
+void run_pipeline (PIPELINE *pipeline);
+void batch_add_files (BATCH *batch, char *name);
+void batch_add_list (BATCH *batch, char *list);
+void batch_progress (BATCH *batch, int32_t file_num, int32_t percent);
+void filter_options (PIPELINE *pipeline, char *options);
+void batch_history (BATCH *batch, char *file, char *options);
+void run_batch (BATCH *batch);
+void sidecar_open (PIPELINE *pipeline);
+void sidecar_put_flags (FILE *fp, gsfSwathBathyPing *ping, int32_t record);
+uint8_t sidecar_get_flags (FILE *fp, int32_t *record, int32_t *beams, uint8_t *bits);
+uint8_t sidecar_set_flags (int32_t hnd, char *file, int32_t record, int32_t beams, uint8_t *bits);
+void sidecar_ping (PIPELINE *pipeline, gsfSwathBathyPing *ping, int32_t record);
+void sidecar_close (PIPELINE *pipeline);
+void sidecar_apply (BATCH *batch, int32_t file_num);
+void sidecar_remove (char *file);
+void run_survey (BATCH *batch);
+void checkpoint_write (PIPELINE *pipeline, PAGE *page);
+void checkpoint_load (PIPELINE *pipeline);
+uint8_t checkpoint_verify (PIPELINE *pipeline, PAGE *page);
+void checkpoint_remove (char *file);
+uint8_t gsf_map_open (GSF_MAP *map, char *file);
+int32_t gsf_map_read (GSF_MAP *map, int32_t record, gsfSwathBathyPing *ping);
+int32_t gsf_map_percent (GSF_MAP *map);
+uint8_t gsf_map_same (gsfSwathBathyPing *ping, gsfSwathBathyPing *gsf_ping);
+void gsf_map_close (GSF_MAP *map);
+int32_t gsf_patch_open (char *file);
+void gsf_patch_flags (int32_t fd, char *file, size_t offset, const unsigned char *flags, int32_t count);
+void gsf_patch_close (int32_t fd, char *file);
+uint8_t simd_select (const char *isa, const char *precision, uint8_t lane_sums);
+uint8_t simd_lane_sums ();
+const char *simd_name ();
+void grid_build (GRID *grid, ARENA *arena, const double *x, const double *y, const float *dep, int32_t count,
+                 double min_x, double min_y, double cell_size, int32_t height, int32_t width, uint8_t tiled);
+void grid_layout (NV_F64_XYMBR *mbr, float avg_z, uint8_t metric, GRID_LAYOUT *layout);
+void grid_stats (GRID *grid, ARENA *arena, FILTER_PARAMS *params);
+void window_alloc (GRID *grid, ARENA *arena, int32_t radius);
+void window_sums (GRID *grid);
+void gsf_filter (GRID *grid, double dx, FILTER_PARAMS *params);
+void grid_filter (GRID *grid, GRID_LAYOUT *layout, ARENA *arena, const double *x, const double *y,
+                  const float *dep, int32_t count, NV_F64_XYMBR *mbr, float avg_z, uint8_t metric,
+                  FILTER_PARAMS *params, PAGE_PROFILE *profile, uint8_t *classic);
 
 
 #endif
@@ -1,5 +1,5 @@
 INCLUDEPATH += /c/PFM_ABEv7.0.0_Win64/include
-LIBS += -L /c/PFM_ABEv7.0.0_Win64/lib -lgsf -lnvutility -lgdal -lxml2 -lpoppler -lm -liconv -lwsock32
+LIBS += -L /c/PFM_ABEv7.0.0_Win64/lib -lgsf -lnvutility -lgdal -lxml2 -lpoppler -lm -liconv -lwsock32 -lpthread
 DEFINES += NVWIN3X
 CONFIG += console
 CONFIG -= qt
@@ -15,4 +15,4 @@ INCLUDEPATH += .
 
 # Input
 HEADERS += gsf_filter.h version.h
-SOURCES += gsf_filter.c main.c write_history.c
+SOURCES += arena.c batch.c checkpoint.c georef.c grid.c gsf_filter.c gsf_map.c main.c page.c pipeline.c sidecar.c simd.c survey.c thread_pool.c window.c write_history.c
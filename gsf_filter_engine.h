@@ -0,0 +1,81 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+#ifndef __GSF_FILTER_ENGINE_H__
+#define __GSF_FILTER_ENGINE_H__
+
+#include <stdint.h>
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+
+/*  The gsf_filter engine as a library (see engine.c).  Create an engine with the filter options, push batches of
+    points at it, and get back a bit set of the points that were filtered.  Each batch is gridded and filtered on
+    its own, the same way gsf_filter does a page.  The point arrays belong to the caller and aren't copied (or
+    changed).  An engine keeps its memory from one batch to the next so pushing many batches doesn't allocate
+    anything once the engine has seen its biggest batch.  One engine should only be used by one thread at a time
+    (use one engine per thread if you need more).  Running out of memory never ends the program,
+    gsf_filter_engine_create returns NULL and gsf_filter_engine_run returns -1 instead.  */
+
+typedef struct GSF_FILTER_ENGINE GSF_FILTER_ENGINE;
+
+
+typedef struct
+{
+  float               std_env;              /*  Standard deviations to filter (default 2.0)  */
+  uint8_t             deep;                 /*  Only filter in the downward direction  */
+  uint8_t             jacobi;               /*  Use the Jacobi filter (see gsf_filter.c)  */
+  uint8_t             metric;               /*  x and y are meters instead of longitude and latitude in degrees  */
+  int32_t             threads;              /*  Threads to filter with, including the caller's (default 1)  */
+  int32_t             passes;               /*  Maximum filter passes (default 1, see gsf_filter.c)  */
+  int32_t             radius;               /*  Neighborhood radius in cells (default 1, see gsf_filter.c)  */
+} GSF_FILTER_OPTIONS;
+
+
+/*  A batch of points.  z is the depth (positive down).  Only pass the points you want filtered (leave out the
+    null and already flagged beams).  Bit i % 8 of byte i / 8 of the result is point i, so keep your own ping and
+    beam numbers in the same order to map the results back.  If you include neighboring points for context (a
+    halo) just ignore their bits.  */
+
+typedef struct
+{
+  const double        *x;
+  const double        *y;
+  const float         *z;
+  int32_t             count;
+} GSF_FILTER_POINTS;
+
+
+void gsf_filter_engine_defaults (GSF_FILTER_OPTIONS *options);
+GSF_FILTER_ENGINE *gsf_filter_engine_create (const GSF_FILTER_OPTIONS *options);
+int32_t gsf_filter_engine_run (GSF_FILTER_ENGINE *engine, const GSF_FILTER_POINTS *points, uint8_t *filtered);
+void gsf_filter_engine_destroy (GSF_FILTER_ENGINE *engine);
+
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
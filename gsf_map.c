@@ -0,0 +1,684 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+#include "gsf_filter.h"
+
+#ifdef NVWIN3X
+    #include <windows.h>
+    #include <io.h>
+    #include <fcntl.h>
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+
+
+/*  Memory mapped GSF reader for --fast_read.
+
+    gsfRead decodes every subrecord of a ping (travel times, beam angles, intensities, sensor specific data, and
+    so on) and then read_page copies the whole thing with gsfCopyRecords, just so that the filter can look at the
+    position, heading, and five of the beam arrays.  Here we map the file and walk the records ourselves, decoding
+    only the ping time, position, heading, ping flags, and the depth, nominal depth, across track, along track, and
+    beam flag arrays straight into the page's ping.  Everything else is skipped using the subrecord sizes.
+
+    This only knows the GSF version 3 layout (all of the numbers are big endian):
+
+        record         4 bytes data size, 4 bytes record ID (bit 31 set if a 4 byte checksum follows), data
+                       (padded to a multiple of 4 bytes)
+        header         "GSF-v03.xx"
+        ping           56 bytes of fixed fields (time, longitude and latitude * 1.0e7, beams, center beam, ping
+                       flags, reserved, tide corrector, depth corrector, heading * 100, ...) then subrecords
+        subrecord      4 bytes (ID << 24 | size), data
+        scale factors  4 bytes count, then for each array (ID << 24 | compression flag << 16), multiplier, offset
+
+    The arrays are 1, 2, or 4 byte integers (the field size is in the high nibble of the compression flag) and the
+    value is integer / multiplier - offset, the same as libgsf.  Scale factors carry over from one ping to the next
+    until a ping has new ones so, to get to a ping, we have to go through all of the pings before it.  The reader
+    is sequential, with the ping that was just read (the one read_page starts the next page with after a position
+    jump) as the only cheap step back.
+
+    If the file isn't version 3, or a ping has anything in it that we don't expect (compressed arrays, sizes that
+    don't match the number of beams, a truncated record), gsf_map_read returns -1 and read_page goes back to
+    gsfRead for the rest of the file.  --fast_read_check reads every ping with gsfRead as well and counts the
+    pings that don't match.
+
+    Filtering only ever changes beam flags, one byte per beam, so instead of gsfWrite re-encoding and rewriting the
+    whole ping we remember where each ping's beam flags are in the file and the writer overwrites just the bytes
+    from the first to the last beam it flagged (gsf_patch_flags).  Records with a checksum can't be patched like
+    that.  Since the ping we decoded is missing everything we skipped it can't be given to gsfWrite either, so the
+    writer reads the whole record again with gsfRead, puts the new flags in it, and writes that.  */
+
+#define PING_FIXED_SIZE       56
+
+
+static inline uint32_t get16 (const uint8_t *ptr)
+{
+  return ((uint32_t) ptr[0] << 8) | (uint32_t) ptr[1];
+}
+
+
+static inline uint32_t get32 (const uint8_t *ptr)
+{
+  return ((uint32_t) ptr[0] << 24) | ((uint32_t) ptr[1] << 16) | ((uint32_t) ptr[2] << 8) | (uint32_t) ptr[3];
+}
+
+
+
+/*  Get the record at offset.  Returns 1 if there is one, 0 at the end of the file, and -1 if the record runs past
+    the end of the file.  */
+
+static int32_t record_at (GSF_MAP *map, size_t offset, uint32_t *id, const uint8_t **data, uint32_t *size,
+                          size_t *next)
+{
+  uint32_t            word;
+
+
+  if (offset >= map->size) return (0);
+  if (offset + 8 > map->size) return (-1);
+
+  *size = get32 (map->base + offset);
+  word = get32 (map->base + offset + 4);
+  *id = word & 0x003fffff;
+
+  offset += 8;
+  if (word & 0x80000000) offset += 4;
+
+  if (offset + (size_t) *size > map->size) return (-1);
+
+  *data = map->base + offset;
+  *next = offset + *size;
+
+  return (1);
+}
+
+
+
+/*  Read a scale factor subrecord into scale.  */
+
+static uint8_t read_scale (const uint8_t *data, uint32_t size, gsfScaleFactors *scale)
+{
+  uint32_t            count, i, word;
+  int32_t             index;
+
+
+  if (size < 4) return (NVFalse);
+
+  count = get32 (data);
+  if (size < 4 + count * 12) return (NVFalse);
+
+  for (i = 0 ; i < count ; i++)
+    {
+      word = get32 (data + 4 + i * 12);
+      index = (int32_t) (word >> 24) - 1;
+
+      if (index < 0 || index >= GSF_MAX_PING_ARRAY_SUBRECORDS) continue;
+
+      scale->scaleTable[index].compressionFlag = (word >> 16) & 0xff;
+      scale->scaleTable[index].multiplier = (double) get32 (data + 4 + i * 12 + 4);
+      scale->scaleTable[index].offset = (double) (int32_t) get32 (data + 4 + i * 12 + 8);
+    }
+
+  scale->numArraySubrecords = count;
+
+  return (NVTrue);
+}
+
+
+
+/*  Pick up the scale factors from a ping that we're skipping over.  */
+
+static uint8_t skip_ping (GSF_MAP *map, const uint8_t *data, uint32_t size)
+{
+  uint32_t            offset, word, sub_size;
+
+
+  if (size < PING_FIXED_SIZE) return (NVFalse);
+
+  for (offset = PING_FIXED_SIZE ; offset + 4 <= size ; offset += 4 + sub_size)
+    {
+      word = get32 (data + offset);
+      sub_size = word & 0x00ffffff;
+
+      if (offset + 4 + sub_size > size) return (NVFalse);
+
+      if ((word >> 24) == GSF_SWATH_BATHY_SUBRECORD_SCALE_FACTORS)
+        return (read_scale (data + offset + 4, sub_size, &map->scale));
+    }
+
+  return (NVTrue);
+}
+
+
+
+/*  Decode a beam array into *array.  signed_values is set for the arrays that libgsf decodes as signed
+    integers.  */
+
+static uint8_t decode_array (const uint8_t *data, uint32_t size, int32_t beams, gsfScaleInfo *scale,
+                             uint8_t signed_values, double **array)
+{
+  int32_t             bytes, i;
+  double              multiplier, offset;
+  double              *values;
+
+
+  if (beams <= 0 || scale->multiplier == 0.0 || (scale->compressionFlag & 0x0f) || size % beams) return (NVFalse);
+
+
+  /*  The field size comes from the scale factors unless it's the default, in which case the subrecord size tells
+      us.  */
+
+  bytes = size / beams;
+  switch (scale->compressionFlag & 0xf0)
+    {
+    case GSF_FIELD_SIZE_DEFAULT:
+      if (bytes != 1 && bytes != 2 && bytes != 4) return (NVFalse);
+      break;
+
+    case GSF_FIELD_SIZE_ONE:
+      if (bytes != 1) return (NVFalse);
+      break;
+
+    case GSF_FIELD_SIZE_TWO:
+      if (bytes != 2) return (NVFalse);
+      break;
+
+    case GSF_FIELD_SIZE_FOUR:
+      if (bytes != 4) return (NVFalse);
+      break;
+
+    default:
+      return (NVFalse);
+    }
+
+
+  if ((values = (double *) realloc (*array, beams * sizeof (double))) == NULL)
+    {
+      perror ("Allocating ping array memory");
+      exit (-1);
+    }
+  *array = values;
+
+
+  multiplier = scale->multiplier;
+  offset = scale->offset;
+
+  switch (bytes)
+    {
+    case 1:
+      if (signed_values)
+        {
+          for (i = 0 ; i < beams ; i++) values[i] = (double) (int8_t) data[i] / multiplier - offset;
+        }
+      else
+        {
+          for (i = 0 ; i < beams ; i++) values[i] = (double) data[i] / multiplier - offset;
+        }
+      break;
+
+    case 2:
+      if (signed_values)
+        {
+          for (i = 0 ; i < beams ; i++) values[i] = (double) (int16_t) get16 (data + 2 * i) / multiplier - offset;
+        }
+      else
+        {
+          for (i = 0 ; i < beams ; i++) values[i] = (double) get16 (data + 2 * i) / multiplier - offset;
+        }
+      break;
+
+    case 4:
+      if (signed_values)
+        {
+          for (i = 0 ; i < beams ; i++) values[i] = (double) (int32_t) get32 (data + 4 * i) / multiplier - offset;
+        }
+      else
+        {
+          for (i = 0 ; i < beams ; i++) values[i] = (double) get32 (data + 4 * i) / multiplier - offset;
+        }
+      break;
+    }
+
+  return (NVTrue);
+}
+
+
+
+/*  Decode the fields the filter uses from a ping record into ping.  ping's arrays are reused (they're allocated
+    with realloc so that gsfFree and gsfCopyRecords can still be used on it).  The arrays that aren't in this ping
+    are freed and set to NULL.  */
+
+static uint8_t decode_ping (GSF_MAP *map, const uint8_t *data, uint32_t size, gsfSwathBathyPing *ping)
+{
+  uint32_t            offset, word, sub_size, id;
+  int32_t             beams;
+  uint8_t             found[GSF_MAX_PING_ARRAY_SUBRECORDS + 1], ok;
+  const uint8_t       *sub;
+
+
+  if (size < PING_FIXED_SIZE) return (NVFalse);
+
+  ping->ping_time.tv_sec = get32 (data);
+  ping->ping_time.tv_nsec = get32 (data + 4);
+  ping->longitude = (double) (int32_t) get32 (data + 8) / 1.0e7;
+  ping->latitude = (double) (int32_t) get32 (data + 12) / 1.0e7;
+  ping->number_beams = (int16_t) get16 (data + 16);
+  ping->center_beam = (int16_t) get16 (data + 18);
+  ping->ping_flags = get16 (data + 20);
+  ping->heading = (double) get16 (data + 30) / 100.0;
+
+  beams = ping->number_beams;
+  memset (found, 0, sizeof (found));
+
+
+  for (offset = PING_FIXED_SIZE ; offset + 4 <= size ; offset += 4 + sub_size)
+    {
+      word = get32 (data + offset);
+      id = word >> 24;
+      sub_size = word & 0x00ffffff;
+      sub = data + offset + 4;
+
+      if (offset + 4 + sub_size > size) return (NVFalse);
+
+      ok = NVTrue;
+      switch (id)
+        {
+        case GSF_SWATH_BATHY_SUBRECORD_SCALE_FACTORS:
+          ok = read_scale (sub, sub_size, &map->scale);
+          break;
+
+        case GSF_SWATH_BATHY_SUBRECORD_DEPTH_ARRAY:
+          ok = decode_array (sub, sub_size, beams, &map->scale.scaleTable[id - 1], NVFalse, &ping->depth);
+          break;
+
+        case GSF_SWATH_BATHY_SUBRECORD_NOMINAL_DEPTH_ARRAY:
+          ok = decode_array (sub, sub_size, beams, &map->scale.scaleTable[id - 1], NVFalse, &ping->nominal_depth);
+          break;
+
+        case GSF_SWATH_BATHY_SUBRECORD_ACROSS_TRACK_ARRAY:
+          ok = decode_array (sub, sub_size, beams, &map->scale.scaleTable[id - 1], NVTrue, &ping->across_track);
+          break;
+
+        case GSF_SWATH_BATHY_SUBRECORD_ALONG_TRACK_ARRAY:
+          ok = decode_array (sub, sub_size, beams, &map->scale.scaleTable[id - 1], NVTrue, &ping->along_track);
+          break;
+
+        case GSF_SWATH_BATHY_SUBRECORD_BEAM_FLAGS_ARRAY:
+          if (beams <= 0 || sub_size != (uint32_t) beams) return (NVFalse);
+
+          if ((ping->beam_flags = (unsigned char *) realloc (ping->beam_flags, beams)) == NULL)
+            {
+              perror ("Allocating ping array memory");
+              exit (-1);
+            }
+          memcpy (ping->beam_flags, sub, beams);
+          map->flag_offset = sub - map->base;
+          break;
+
+        default:
+          id = 0;
+          break;
+        }
+
+      if (!ok) return (NVFalse);
+      if (id <= GSF_MAX_PING_ARRAY_SUBRECORDS) found[id] = NVTrue;
+    }
+
+
+  /*  Drop the arrays left over from whatever ping was in here before.  */
+
+  if (!found[GSF_SWATH_BATHY_SUBRECORD_DEPTH_ARRAY])
+    {
+      free (ping->depth);
+      ping->depth = NULL;
+    }
+
+  if (!found[GSF_SWATH_BATHY_SUBRECORD_NOMINAL_DEPTH_ARRAY])
+    {
+      free (ping->nominal_depth);
+      ping->nominal_depth = NULL;
+    }
+
+  if (!found[GSF_SWATH_BATHY_SUBRECORD_ACROSS_TRACK_ARRAY])
+    {
+      free (ping->across_track);
+      ping->across_track = NULL;
+    }
+
+  if (!found[GSF_SWATH_BATHY_SUBRECORD_ALONG_TRACK_ARRAY])
+    {
+      free (ping->along_track);
+      ping->along_track = NULL;
+    }
+
+  if (!found[GSF_SWATH_BATHY_SUBRECORD_BEAM_FLAGS_ARRAY])
+    {
+      free (ping->beam_flags);
+      ping->beam_flags = NULL;
+    }
+
+  ping->scaleFactors = map->scale;
+
+  return (NVTrue);
+}
+
+
+
+/*  Map the file and check that it's a version 3 GSF file.  Returns NVFalse (with map->base set to NULL) if we
+    can't use the map, in which case the file should be read with gsfRead.  */
+
+uint8_t gsf_map_open (GSF_MAP *map, char *file)
+{
+  uint32_t            id, size;
+  const uint8_t       *data;
+  size_t              next, offset;
+  int32_t             status;
+
+
+  memset (map, 0, sizeof (GSF_MAP));
+
+
+#ifdef NVWIN3X
+
+  {
+    HANDLE              file_hnd, map_hnd;
+    LARGE_INTEGER       file_size;
+
+
+    file_hnd = CreateFile (file, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file_hnd == INVALID_HANDLE_VALUE) return (NVFalse);
+
+    if (!GetFileSizeEx (file_hnd, &file_size) || file_size.QuadPart == 0)
+      {
+        CloseHandle (file_hnd);
+        return (NVFalse);
+      }
+    map->size = (size_t) file_size.QuadPart;
+
+    map_hnd = CreateFileMapping (file_hnd, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (map_hnd != NULL)
+      {
+        map->base = (uint8_t *) MapViewOfFile (map_hnd, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle (map_hnd);
+      }
+    CloseHandle (file_hnd);
+
+    if (map->base == NULL) return (NVFalse);
+  }
+
+#else
+
+  {
+    int                 fd;
+    struct stat         st;
+    void                *base;
+
+
+    if ((fd = open (file, O_RDONLY)) < 0) return (NVFalse);
+
+    if (fstat (fd, &st) || st.st_size == 0)
+      {
+        close (fd);
+        return (NVFalse);
+      }
+    map->size = (size_t) st.st_size;
+
+    base = mmap (NULL, map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd);
+
+    if (base == MAP_FAILED) return (NVFalse);
+    map->base = (uint8_t *) base;
+
+    madvise (base, map->size, MADV_SEQUENTIAL);
+  }
+
+#endif
+
+
+  /*  The first record has to be a version 3 header.  */
+
+  if (record_at (map, 0, &id, &data, &size, &next) <= 0 || id != GSF_RECORD_HEADER || size < 8 ||
+      strncmp ((const char *) data, "GSF-v03.", 8))
+    {
+      fprintf (stderr, "%s isn't a GSF version 3 file, reading it with gsfRead\n", file);
+      gsf_map_close (map);
+      return (NVFalse);
+    }
+
+  map->first = map->offset = next;
+  map->next_ping = 1;
+
+
+  /*  The size of the first ping is used to guess how many pings there are (we don't want to go through the whole
+      file just to count them).  */
+
+  for (offset = next ; (status = record_at (map, offset, &id, &data, &size, &next)) > 0 ; offset = next)
+    {
+      if (id == GSF_RECORD_SWATH_BATHYMETRY_PING)
+        {
+          map->ping_bytes = next - offset;
+          break;
+        }
+    }
+
+  return (NVTrue);
+}
+
+
+
+/*  Read ping number record (starting at 1) into ping.  Returns 1 if the ping was read, 0 if there is no such ping,
+    and -1 if the ping can't be decoded here (read it with gsfRead).  */
+
+int32_t gsf_map_read (GSF_MAP *map, int32_t record, gsfSwathBathyPing *ping)
+{
+  uint32_t            id, size;
+  const uint8_t       *data;
+  size_t              next;
+  int32_t             status;
+
+
+  /*  Step back to the last ping, or start over from the beginning of the file.  */
+
+  if (record < map->next_ping)
+    {
+      if (record == map->last_ping)
+        {
+          map->offset = map->last_offset;
+          map->scale = map->last_scale;
+          map->next_ping = record;
+        }
+      else
+        {
+          map->offset = map->first;
+          map->next_ping = 1;
+          memset (&map->scale, 0, sizeof (gsfScaleFactors));
+        }
+    }
+
+
+  while ((status = record_at (map, map->offset, &id, &data, &size, &next)) > 0)
+    {
+      if (id == GSF_RECORD_SWATH_BATHYMETRY_PING)
+        {
+          if (map->next_ping == record)
+            {
+              map->last_offset = map->offset;
+              map->last_ping = record;
+              map->last_scale = map->scale;
+              map->flag_offset = 0;
+
+              if (!decode_ping (map, data, size, ping)) return (-1);
+
+
+              /*  Patching the flags would make the checksum wrong.  */
+
+              map->checksum = ((size_t) (data - map->base) > map->offset + 8);
+              if (map->checksum) map->flag_offset = 0;
+
+              map->offset = next;
+              map->next_ping++;
+
+              return (1);
+            }
+
+          if (!skip_ping (map, data, size)) return (-1);
+
+          map->next_ping++;
+        }
+
+      map->offset = next;
+    }
+
+  return (status);
+}
+
+
+
+/*  How far through the file we are.  */
+
+int32_t gsf_map_percent (GSF_MAP *map)
+{
+  if (map->size == 0) return (0);
+
+  return ((int32_t) ((double) map->offset * 100.0 / (double) map->size));
+}
+
+
+
+static uint8_t same_array (const void *array, const void *gsf_array, size_t bytes)
+{
+  if (array == NULL || gsf_array == NULL) return (array == gsf_array);
+
+  return (!memcmp (array, gsf_array, bytes));
+}
+
+
+
+/*  Check that the fields decoded by gsf_map_read are the same as the ones from gsfRead.  */
+
+uint8_t gsf_map_same (gsfSwathBathyPing *ping, gsfSwathBathyPing *gsf_ping)
+{
+  size_t              beams = MAX (ping->number_beams, 0);
+
+
+  if (ping->latitude != gsf_ping->latitude || ping->longitude != gsf_ping->longitude ||
+      ping->heading != gsf_ping->heading || ping->ping_flags != gsf_ping->ping_flags ||
+      ping->number_beams != gsf_ping->number_beams) return (NVFalse);
+
+  if (!beams) return (NVTrue);
+
+  return (same_array (ping->depth, gsf_ping->depth, beams * sizeof (double)) &&
+          same_array (ping->nominal_depth, gsf_ping->nominal_depth, beams * sizeof (double)) &&
+          same_array (ping->across_track, gsf_ping->across_track, beams * sizeof (double)) &&
+          same_array (ping->along_track, gsf_ping->along_track, beams * sizeof (double)) &&
+          same_array (ping->beam_flags, gsf_ping->beam_flags, beams));
+}
+
+
+
+void gsf_map_close (GSF_MAP *map)
+{
+  if (map->base != NULL)
+    {
+#ifdef NVWIN3X
+      UnmapViewOfFile (map->base);
+#else
+      munmap (map->base, map->size);
+#endif
+    }
+
+  map->base = NULL;
+}
+
+
+
+/*  Open the file for patching the beam flags.  */
+
+int32_t gsf_patch_open (char *file)
+{
+  int32_t             fd;
+
+
+#ifdef NVWIN3X
+  fd = _open (file, _O_RDWR | _O_BINARY);
+#else
+  fd = open (file, O_RDWR);
+#endif
+
+  if (fd < 0)
+    {
+      perror (file);
+      exit (-1);
+    }
+
+  return (fd);
+}
+
+
+
+/*  Overwrite count beam flags at offset in the file.  */
+
+void gsf_patch_flags (int32_t fd, char *file, size_t offset, const unsigned char *flags, int32_t count)
+{
+  int64_t             done;
+
+
+#ifdef NVWIN3X
+
+  if (_lseeki64 (fd, (__int64) offset, SEEK_SET) < 0)
+    {
+      perror (file);
+      exit (-1);
+    }
+
+  done = _write (fd, flags, count);
+
+#else
+
+  done = pwrite (fd, flags, count, (off_t) offset);
+
+#endif
+
+  if (done != count)
+    {
+      perror (file);
+      exit (-1);
+    }
+}
+
+
+
+void gsf_patch_close (int32_t fd, char *file)
+{
+#ifdef NVWIN3X
+  if (_close (fd))
+#else
+  if (close (fd))
+#endif
+    {
+      perror (file);
+      exit (-1);
+    }
+}
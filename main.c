@@ -30,45 +30,146 @@ extern int32_t gsfError;
 
 void usage ()
 {
-      fprintf (stderr, "USAGE: gsf_filter [--std STD] [--deep] GSF_FILE\n\n");
+      fprintf (stderr, "USAGE: gsf_filter [--std STD] [--deep] [--threads THREADS] [--jacobi] [--jacobi_check] [--isa ISA]\n");
+      fprintf (stderr, "                  [--pipeline DEPTH] [--jobs JOBS] [--memory MEMORY] [--list LIST_FILE]\n");
+      fprintf (stderr, "                  [--precision PRECISION] [--fast_georef] [--georef_check] [--halo PINGS] [--rotate]\n");
+      fprintf (stderr, "                  [--profile PROFILE_FILE] [--sidecar] [--apply] [--resume] [--passes PASSES]\n");
+      fprintf (stderr, "                  [--radius RADIUS] [--fast_read] [--fast_read_check] [--survey]\n");
+      fprintf (stderr, "                  [--tile_size TILE_SIZE] [--tile_dir TILE_DIR] [--lane_sums]\n");
+      fprintf (stderr, "                  [GSF_FILE ...]\n\n");
       fprintf (stderr, "Where:\n");
-      fprintf (stderr, "\tGSF_FILE = Path to GSF file.\n");
+      fprintf (stderr, "\tGSF_FILE = Path to GSF file.  There may be any number of these and they may contain\n");
+      fprintf (stderr, "\t\twildcards (e.g. \"/data/survey/*.d01\").\n");
       fprintf (stderr, "\tSTD = Optional number of standard deviations to filter (default = 2.0)\n");
-      fprintf (stderr, "\t-d = Filter only in the downward (deep filter) direction\n\n");
+      fprintf (stderr, "\t-d = Filter only in the downward (deep filter) direction\n");
+      fprintf (stderr, "\tTHREADS = Optional number of threads to use for the filter (default = number of\n");
+      fprintf (stderr, "\t\tprocessors).  The results are the same for any number of threads.\n");
+      fprintf (stderr, "\t--jacobi = Filter every cell against a snapshot of its neighbors' statistics instead of\n");
+      fprintf (stderr, "\t\tthe statistics already cleaned up by the sweep.  Fully parallel, slightly different results.\n");
+      fprintf (stderr, "\t--jacobi_check = Same as --jacobi but also run the normal filter and report how many flags\n");
+      fprintf (stderr, "\t\tdiffer between the two.\n");
+      fprintf (stderr, "\tISA = Optional vector instruction set for the per cell kernels, one of auto, scalar, sse4.2,\n");
+      fprintf (stderr, "\t\tavx2, or avx512 (default = auto).  The results are the same for all of them.\n");
+      fprintf (stderr, "\tPRECISION = Optional precision for the threshold test in the per cell kernels, double or\n");
+      fprintf (stderr, "\t\tfloat (default = double).  The results are the same for both.  float is faster when the\n");
+      fprintf (stderr, "\t\tcells hold more than about 16 soundings and slower when they hold only a few.\n");
+      fprintf (stderr, "\tDEPTH = Optional number of pages that may be queued between the read, filter, and write\n");
+      fprintf (stderr, "\t\tstages (default = 2).  The stages run in their own threads so reading and writing overlap\n");
+      fprintf (stderr, "\t\tthe filtering.  0 runs the stages one after the other.\n");
+      fprintf (stderr, "\tJOBS = Optional number of files to filter at the same time (default = 1).  All of the\n");
+      fprintf (stderr, "\t\tfiles share the THREADS filter threads.\n");
+      fprintf (stderr, "\tMEMORY = Optional memory budget in megabytes (default = no limit).  A file isn't started\n");
+      fprintf (stderr, "\t\tuntil its estimated memory use fits in the budget (unless nothing else is running).\n");
+      fprintf (stderr, "\tLIST_FILE = Optional file containing GSF file names (or wildcard patterns), one per line.\n");
+      fprintf (stderr, "\t\tBlank lines and lines starting with # are ignored.\n");
+      fprintf (stderr, "\t--fast_georef = Position the beams using a local tangent plane at each ping instead of the\n");
+      fprintf (stderr, "\t\tfull geodesic solution.  Much faster, within a few millimeters for swaths up to 10 km\n");
+      fprintf (stderr, "\t\twide below 60 degrees of latitude.\n");
+      fprintf (stderr, "\t--georef_check = Same as --fast_georef but also compute the full geodesic positions and\n");
+      fprintf (stderr, "\t\treport the largest difference between the two.\n");
+      fprintf (stderr, "\tPINGS = Optional number of pings from each of the neighboring pages to include in the\n");
+      fprintf (stderr, "\t\tstatistics for a page (default = 0, maximum = 1000).  This gives the cells at the ends of\n");
+      fprintf (stderr, "\t\tthe 1000 ping pages the same neighbors they would have in the middle of a page.\n");
+      fprintf (stderr, "\t--rotate = Grid each page in a frame rotated to its mean heading instead of north up.  This\n");
+      fprintf (stderr, "\t\tlines the cells up with the swath on lines that aren't run north/south or east/west.\n");
+      fprintf (stderr, "\tPROFILE_FILE = Optional file to write a JSON line to for every page, with the page's ping,\n");
+      fprintf (stderr, "\t\tsounding, grid, filtered, and rewritten ping counts and the seconds spent in each stage.\n");
+      fprintf (stderr, "\t--sidecar = Don't change the GSF files.  Write the filter flags for each file to a sidecar\n");
+      fprintf (stderr, "\t\tfile (GSF_FILE.flg) instead.\n");
+      fprintf (stderr, "\t--apply = Don't filter.  Set the flags from the sidecar files written by an earlier\n");
+      fprintf (stderr, "\t\t--sidecar run in the GSF files.\n");
+      fprintf (stderr, "\t--resume = Pick up each file from where an earlier run that was stopped left off.  A\n");
+      fprintf (stderr, "\t\tcheckpoint (GSF_FILE.ckp) is written for every page and removed when the file is done.\n");
+      fprintf (stderr, "\tPASSES = Optional maximum number of filter passes over each page (default = 1).  After the\n");
+      fprintf (stderr, "\t\tfirst pass only the cells around the ones that changed are filtered again, until\n");
+      fprintf (stderr, "\t\tnothing changes or PASSES passes have been made.  This catches outliers that only stand\n");
+      fprintf (stderr, "\t\tout once their neighbors have been cleaned up.\n");
+      fprintf (stderr, "\tRADIUS = Optional neighborhood radius in cells (default = 1, the 3 by 3 neighborhood,\n");
+      fprintf (stderr, "\t\tmaximum = 50).  Each cell is tested against the cells within RADIUS of it (a 5 by 5\n");
+      fprintf (stderr, "\t\tneighborhood for 2, 7 by 7 for 3, and so on).  Wider neighborhoods are for deep water\n");
+      fprintf (stderr, "\t\tdata and always use the statistics from before the sweep like --jacobi.  On sloping or\n");
+      fprintf (stderr, "\t\twavy seafloor a wide neighborhood with --passes can keep cutting into the slope, so check\n");
+      fprintf (stderr, "\t\tthe results before using the two together.  The filter time goes up with RADIUS (about\n");
+      fprintf (stderr, "\t\t2 * RADIUS + 1 row lookups per cell for every pass).\n");
+      fprintf (stderr, "\t--fast_read = Read the pings through a memory map, decoding only the fields the filter\n");
+      fprintf (stderr, "\t\tuses, instead of with the GSF library, and write the flags back by overwriting just the\n");
+      fprintf (stderr, "\t\tbeam flag bytes instead of rewriting the whole ping.  The file is read in order so the\n");
+      fprintf (stderr, "\t\tGSF index file isn't needed (or built).  Only for GSF version 3 files.  Falls back to\n");
+      fprintf (stderr, "\t\tthe GSF library for anything it can't decode.\n");
+      fprintf (stderr, "\t--fast_read_check = Same as --fast_read but also read every ping with the GSF library\n");
+      fprintf (stderr, "\t\tand report how many of them differ.\n");
+      fprintf (stderr, "\t--survey = Filter all of the files together instead of one at a time, so that overlapping\n");
+      fprintf (stderr, "\t\tlines are filtered against each other.  The soundings are binned into square tiles that\n");
+      fprintf (stderr, "\t\tare filtered one after the other and the flags are then set in the files they came from\n");
+      fprintf (stderr, "\t\t(or written to the sidecar files with --sidecar).  MEMORY is the memory for the tiles\n");
+      fprintf (stderr, "\t\tand flags (default = 1024), the rest are written to temporary files in TILE_DIR.\n");
+      fprintf (stderr, "\t\t--jobs, --pipeline, --halo, --rotate, --resume, and --profile don't apply.\n");
+      fprintf (stderr, "\tTILE_SIZE = Optional survey tile size in meters (default = 1000, 10 to 100000).\n");
+      fprintf (stderr, "\tTILE_DIR = Optional directory for the survey tile and flag files (default = current\n");
+      fprintf (stderr, "\t\tdirectory).\n");
+      fprintf (stderr, "\t--lane_sums = Add up the depths in each cell eight at a time with the vector instruction set\n");
+      fprintf (stderr, "\t\tinstead of one at a time.  Faster for big cells.  The sums can differ in the last bits\n");
+      fprintf (stderr, "\t\tfrom the normal ones for cells of more than eight soundings so a sounding right on the\n");
+      fprintf (stderr, "\t\tthreshold may be flagged differently.\n\n");
 }
 
 
 int32_t main (int32_t argc, char **argv)
 {
-  gsfDataID           id;
-  gsfRecords          gsf_record;
-  int32_t             hnd, i, j, k, recnum, percent = 0, old_percent = -1, ret, start_rec, count, page_size = 1000;
-  int32_t             grid_height = 0, grid_width = 0, xn, yn, *aping = NULL, prev_ping = -1, option_index = 0;
-  int16_t             *abeam = NULL;
-  float               std_env, dep, *adep = NULL, avg_z;
-  double              *alat = NULL, *alon = NULL, lateral, ang1, ang2, lat, lon, sum_z, sum2_z, grid_size;
-  double              dx, rlat1, rlat2, rlon1, rlon2, az, prev_lat = -999.0, prev_lon = -999.0;
-  NV_F64_COORD2       xy2, nxy;
-  NV_F64_XYMBR        mbr;
-  char                c, comment[16384], file[512];
-  uint8_t             endloop = NVFalse, skipflag = NVFalse, flushflag = NVFalse, deepflag = NVFalse;
-  GRID_REC            **grid = NULL;
+  int32_t             i, threads, depth, passes, radius, option_index = 0;
+  float               std_env, memory;
+  char                c, isa[32], precision[32];
+  uint8_t             deepflag = NVFalse, jacobi = NVFalse, jacobi_check = NVFalse, lane_sums = NVFalse;
+  BATCH               batch;
+  THREAD_POOL         *pool;
   extern char         *optarg;
   extern int          optind;
   static struct option long_options[] = {{"std", required_argument, 0, 0},
                                          {"deep", no_argument, 0, 0},
+                                         {"threads", required_argument, 0, 0},
+                                         {"jacobi", no_argument, 0, 0},
+                                         {"jacobi_check", no_argument, 0, 0},
+                                         {"isa", required_argument, 0, 0},
+                                         {"pipeline", required_argument, 0, 0},
+                                         {"jobs", required_argument, 0, 0},
+                                         {"memory", required_argument, 0, 0},
+                                         {"list", required_argument, 0, 0},
+                                         {"fast_georef", no_argument, 0, 0},
+                                         {"georef_check", no_argument, 0, 0},
+                                         {"halo", required_argument, 0, 0},
+                                         {"rotate", no_argument, 0, 0},
+                                         {"profile", required_argument, 0, 0},
+                                         {"sidecar", no_argument, 0, 0},
+                                         {"apply", no_argument, 0, 0},
+                                         {"resume", no_argument, 0, 0},
+                                         {"precision", required_argument, 0, 0},
+                                         {"passes", required_argument, 0, 0},
+                                         {"radius", required_argument, 0, 0},
+                                         {"fast_read", no_argument, 0, 0},
+                                         {"fast_read_check", no_argument, 0, 0},
+                                         {"survey", no_argument, 0, 0},
+                                         {"tile_size", required_argument, 0, 0},
+                                         {"tile_dir", required_argument, 0, 0},
+                                         {"lane_sums", no_argument, 0, 0},
                                          {0, no_argument, 0, 0}};
 
 
 
-  int32_t write_history (int32_t, char **, char *, char *, int32_t);
-
-
   printf ("\n\n %s \n\n",VERSION);
 
 
   deepflag = NVFalse;
   std_env = 2.0;
+  threads = cpu_count ();
+  strcpy (isa, "auto");
+  strcpy (precision, "double");
+  depth = 2;
+  passes = 1;
+  radius = 1;
+  memory = 0.0;
+  memset (&batch, 0, sizeof (BATCH));
+  batch.jobs = 1;
+  batch.tile_size = 1000.0;
 
 
   while (NVTrue) 
@@ -90,467 +191,193 @@ int32_t main (int32_t argc, char **argv)
             case 1:
               deepflag = NVTrue;
               break;
-            }
-          break;
-
-        default:
-          usage ();
-          exit (-1);
-          break;
-        }
-    }
-
-
-  /* Make sure we got the mandatory file name argument.  */
-
-  if (optind >= argc)
-    {
-      usage ();
-      exit (-1);
-    }
-
-
-  strcpy (file, argv[optind]);
 
-  if (gsfOpen (file, GSF_UPDATE_INDEX, &hnd))
-    {
-      gsfPrintError (stderr);
-      exit (-1);
-    }
-
-
-  printf ("File : %s\n\n", file);
-
-
-  start_rec = recnum = 1;
-
-
-  while (!endloop)
-    {
-      count = 0;
-      mbr.min_x = 999.0;
-      mbr.max_x = -999.0;
-      mbr.min_y = 999.0;
-      mbr.max_y = -999.0;
-      sum_z = 0.0;
-      skipflag = NVFalse;
-
-
-      /*  Read "page_size" pings and load them into local memory.  */
-
-      for (j = start_rec ; j < start_rec + page_size ; j++)
-        {
-          id.recordID = GSF_RECORD_SWATH_BATHYMETRY_PING;
-          id.record_number = j;
-
-          if (gsfRead (hnd, GSF_RECORD_SWATH_BATHYMETRY_PING, &id, &gsf_record, NULL, 0) < 0)
-            {
-              endloop = NVTrue;
-
-              if (gsfError != GSF_INVALID_RECORD_NUMBER) gsfPrintError(stderr);
+            case 2:
+              sscanf (optarg, "%d", &threads);
+              if (threads < 1) threads = 1;
               break;
-            }
-
-
-          lat = gsf_record.mb_ping.latitude;
-          lon = gsf_record.mb_ping.longitude;
-
-
-          /*  Only deal with valid pings.  */
-
-          if ((lat <= 90.0) && (lon <= 180.0) && !(gsf_record.mb_ping.ping_flags & GSF_IGNORE_PING))
-            {
-              /*  If we jumped more than 1000 meters we want to close this box, process it,
-                  and then start over with this record.  */
-
-              invgp (NV_A0, NV_B0, lat, lon, prev_lat, prev_lon, &dx, &az);
-              if (prev_lat > -900.0 && dx > 1000.0)
-                {
-                  start_rec = j;
-                  skipflag = NVTrue;
-                  break;
-                }
-              prev_lat = lat;
-              prev_lon = lon;
-
-
-              ang1 = gsf_record.mb_ping.heading + 90.0;
-              ang2 = gsf_record.mb_ping.heading;
-
-
-              for (i = 0 ; i < gsf_record.mb_ping.number_beams ; i++) 
-                {
-                  dep = gsf_record.mb_ping.depth[i];
-                  if (dep == 0.0 && gsf_record.mb_ping.nominal_depth != NULL) dep = gsf_record.mb_ping.nominal_depth[i];
-
-
-                  /*  Only deal with valid beams.  */
-
-                  if (dep != 0.0 && gsf_record.mb_ping.beam_flags != NULL && 
-                      !(check_flag (gsf_record.mb_ping.beam_flags[i], NV_GSF_IGNORE_NULL_BEAM)) &&
-                      !(check_flag (gsf_record.mb_ping.beam_flags[i], (NV_GSF_IGNORE_MANUALLY_EDITED | 
-                                                                       NV_GSF_IGNORE_FILTER_EDITED)))) 
-                    {
-                      /*  Adjust for cross track position.  */
-
-                      lateral = gsf_record.mb_ping.across_track[i];
-                      newgp (lat, lon, ang1, lateral, &nxy.y, &nxy.x);
-
-
-                      /*  if the along track array is present then use it  */
-                
-                      if (gsf_record.mb_ping.along_track != (double *) NULL) 
-                        {
-                          xy2.y = nxy.y;
-                          xy2.x = nxy.x;
-                          lateral = gsf_record.mb_ping.along_track[i];
-
-                          newgp (xy2.y, xy2.x, ang2, lateral, &nxy.y, &nxy.x);
-                        }
-
-
-                      /*  Reallocate the point memory.  */
-
-                      alat = (double *) realloc (alat, (count + 1) * sizeof (double));
-                      if (alat == NULL)
-                        {
-                          perror ("Allocating alat memory");
-                          exit (-1);
-                        }
-
-                      alon = (double *) realloc (alon, (count + 1) * sizeof (double));
-                      if (alon == NULL)
-                        {
-                          perror ("Allocating alon memory");
-                          exit (-1);
-                        }
-
-                      adep = (float *) realloc (adep, (count + 1) * sizeof (float));
-                      if (adep == NULL)
-                        {
-                          perror ("Allocating adep memory");
-                          exit (-1);
-                        }
-
-                      aping = (int32_t *) realloc (aping, (count + 1) * sizeof (int32_t));
-                      if (aping == NULL)
-                        {
-                          perror ("Allocating aping memory");
-                          exit (-1);
-                        }
-
-                      abeam = (int16_t *) realloc (abeam, (count + 1) * sizeof (int16_t));
-                      if (abeam == NULL)
-                        {
-                          perror ("Allocating abeam memory");
-                          exit (-1);
-                        }
-
-
-                      /*  Save the point and compute the mbr.  */
-
-                      alat[count] = nxy.y;
-                      alon[count] = nxy.x;
-                      adep[count] = dep;
-                      aping[count] = j;
-                      abeam[count] = i;
-
-                      if (alat[count] < mbr.min_y) mbr.min_y = alat[count];
-                      if (alat[count] > mbr.max_y) mbr.max_y = alat[count];
-                      if (alon[count] < mbr.min_x) mbr.min_x = alon[count];
-                      if (alon[count] > mbr.max_x) mbr.max_x = alon[count];
-                      sum_z += adep[count];
-
-                      count++;
-                    }
-                }
-            }
-        }
-
-
-      /*  If we got some points, process them.  */
-
-      if (count)
-        {
-          /*  Average depth.  */
-
-          avg_z = (float) sum_z / (float) count;
-
-
-          /*  Compute the grid size.  This is based on a straight down, one-degree footprint size for the
-              average depth, times 4.  */
-
-          grid_size = avg_z * 0.017453736 * 4.0 / 111120.0;
-
-          grid_height = NINT (((mbr.max_y - mbr.min_y)) / grid_size + 1.0);
-          grid_width = NINT (((mbr.max_x - mbr.min_x)) / grid_size + 1.0);
 
+            case 3:
+              jacobi = NVTrue;
+              break;
 
-          /*  Make sure we don't have too large a grid.  */
+            case 4:
+              jacobi = jacobi_check = NVTrue;
+              break;
 
-          while (grid_height > 5000 || grid_width > 5000)
-            { 
-              grid_size *= 2.0;
-              grid_height = NINT (((mbr.max_y - mbr.min_y)) / grid_size + 1.0);
-              grid_width = NINT (((mbr.max_x - mbr.min_x)) / grid_size + 1.0);
-            }
+            case 5:
+              strncpy (isa, optarg, sizeof (isa) - 1);
+              isa[sizeof (isa) - 1] = 0;
+              break;
 
+            case 6:
+              sscanf (optarg, "%d", &depth);
+              if (depth < 0) depth = 0;
+              break;
 
-          /*  Compute the diagonal in meters of a grid cell at the center of the grid.  */
+            case 7:
+              sscanf (optarg, "%d", &batch.jobs);
+              if (batch.jobs < 1) batch.jobs = 1;
+              break;
 
-          rlat1 = mbr.min_y + (mbr.max_y - mbr.min_y) / 2.0;
-          rlon1 = mbr.min_x + (mbr.max_x - mbr.min_x) / 2.0;
-          rlat2 = rlat1 + grid_size;
-          rlon2 = rlon1 + grid_size;
+            case 8:
+              sscanf (optarg, "%f", &memory);
+              if (memory < 0.0) memory = 0.0;
+              break;
 
-          invgp (NV_A0, NV_B0, rlat1, rlon1, rlat2, rlon2, &dx, &az);
+            case 9:
+              batch_add_list (&batch, optarg);
+              break;
 
+            case 10:
+              batch.options.fast_georef = NVTrue;
+              break;
 
-          /*  Allocate the grid memory.  */
+            case 11:
+              batch.options.fast_georef = batch.options.georef_check = NVTrue;
+              break;
 
-          grid = (GRID_REC **) calloc (grid_height, sizeof (GRID_REC *));
-          if (grid == NULL)
-            {
-              perror ("Allocating grid memory");
-              exit (-1);
-            }
+            case 12:
+              sscanf (optarg, "%d", &batch.options.halo);
+              batch.options.halo = MAX (0, MIN (batch.options.halo, PINGS_PER_PAGE));
+              break;
 
+            case 13:
+              batch.options.rotate = NVTrue;
+              break;
 
-          for (i = 0 ; i < grid_height ; i++)
-            {
-              grid[i] = (GRID_REC *) calloc (grid_width, sizeof (GRID_REC));
-              if (grid[i] == NULL)
+            case 14:
+              if ((batch.options.profile = fopen (optarg, "w")) == NULL)
                 {
-                  perror ("Allocating grid element memory");
+                  perror (optarg);
                   exit (-1);
                 }
+              break;
 
+            case 15:
+              batch.options.sidecar = NVTrue;
+              break;
 
-              for (j = 0 ; j < grid_width ; j++) 
-                {
-                  grid[i][j].count = 0;
-                  grid[i][j].depths = NULL;
-                }
-            }
-
-
-          /*  Load the grid data from the input points.  */
-
-          for (i = 0 ; i < count ; i++)
-            {
-              xn = (int32_t) ((alon[i] - mbr.min_x) / grid_size);
-              yn = (int32_t) ((alat[i] - mbr.min_y) / grid_size);
+            case 16:
+              batch.apply = NVTrue;
+              break;
 
+            case 17:
+              batch.options.resume = NVTrue;
+              break;
 
-              grid[yn][xn].depths = (DEPTH_REC *) realloc (grid[yn][xn].depths, (grid[yn][xn].count + 1) * sizeof (DEPTH_REC));
-              if (grid[yn][xn].depths == NULL)
+            case 18:
+              strncpy (precision, optarg, sizeof (precision) - 1);
+              precision[sizeof (precision) - 1] = 0;
+              if (strcmp (precision, "float") && strcmp (precision, "double"))
                 {
-                  perror ("Allocating grid depth memory");
+                  usage ();
                   exit (-1);
                 }
+              break;
 
-              grid[yn][xn].depths[grid[yn][xn].count].index = i;
-              grid[yn][xn].depths[grid[yn][xn].count].filtered = NVFalse;
-              grid[yn][xn].count++;
-            }
-
-
-          /*  Free the local position data.  */
-
-          free (alat);
-          alat = NULL;
-          free (alon);
-          alon = NULL;
-
+            case 19:
+              sscanf (optarg, "%d", &passes);
+              if (passes < 1) passes = 1;
+              break;
 
-          /*  Compute the average and standard deviation for each grid node that has data.  */
+            case 20:
+              sscanf (optarg, "%d", &radius);
+              radius = MAX (1, MIN (radius, 50));
+              break;
 
-          for (i = 0 ; i < grid_height ; i++)
-            {
-              for (j = 0 ; j < grid_width ; j++)
-                {
-                  if (grid[i][j].count)
-                    {
-                      grid[i][j].cleared = NVFalse;
-                      sum_z = 0.0;
-                      sum2_z = 0.0;
-                      for (k = 0 ; k < grid[i][j].count ; k++)
-                        {
-                          sum_z += adep[grid[i][j].depths[k].index];
-                          sum2_z += (adep[grid[i][j].depths[k].index] * adep[grid[i][j].depths[k].index]);
-                        }
-
-                      grid[i][j].avg = sum_z / (double) grid[i][j].count;
-
-                      if (grid[i][j].count > 1)
-                        {
-                          grid[i][j].std = sqrt ((sum2_z - ((double) grid[i][j].count * 
-                                                            (pow ((double) grid[i][j].avg, 2.0)))) / 
-                                                 ((double) grid[i][j].count - 1.0));
-                        } 
-                      else 
-                        {
-                          grid[i][j].std = 0.0;
-                        }
-                    }
-                }
-            }
+            case 21:
+              batch.options.fast_read = NVTrue;
+              break;
 
+            case 22:
+              batch.options.fast_read = batch.options.fast_read_check = NVTrue;
+              break;
 
-          /*  Filter the grid.  */
+            case 23:
+              batch.survey = NVTrue;
+              break;
 
-          gsf_filter (grid, grid_height, grid_width, adep, dx, std_env, deepflag);
+            case 24:
+              sscanf (optarg, "%lf", &batch.tile_size);
+              if (batch.tile_size < 10.0 || batch.tile_size > 100000.0) batch.tile_size = 1000.0;
+              break;
 
+            case 25:
+              batch.tile_dir = optarg;
+              break;
 
-          percent = gsfPercent (hnd);
-          if (old_percent != percent)
-            {
-              printf ("%3d%% processed    \r", percent);
-              fflush (stdout);
-              old_percent = percent;
+            case 26:
+              lane_sums = NVTrue;
+              break;
             }
+          break;
 
-
-          /*  Transfer the filtered flags to the adep array by setting the depth to -999999.0 if it is filtered.  
-              This way we can do the writes in sequential order instead of bouncing all over the GSF file.  */
-
-          for (i = 0 ; i < grid_height ; i++)
-            {
-              for (j = 0 ; j < grid_width ; j++)
-                {
-                  for (k = 0 ; k < grid[i][j].count ; k++)
-                    {
-                      if (grid[i][j].depths[k].filtered)
-                        {
-                          adep[grid[i][j].depths[k].index] = -999999.0;
-                        }
-                    }
-                }
-            }
+        default:
+          usage ();
+          exit (-1);
+          break;
+        }
+    }
 
 
-          /*  Loop through the data and write out the changed records to the GSF file.  */
+  /*  Pick the per cell kernels.  */
 
-          prev_ping = -1;
-          for (i = 0 ; i < count ; i++)
-            {
-              if (adep[i] == -999999.0)
-                {
-                  if (aping[i] != prev_ping)
-                    {
-                      if (prev_ping != -1)
-                        {
-                          id.recordID = GSF_RECORD_SWATH_BATHYMETRY_PING;
-                          id.record_number = prev_ping;
-
-                          if (gsfWrite(hnd, &id, &gsf_record) < 0)
-                            {
-                              gsfPrintError(stderr);
-                              exit(-1);
-                            }
-                          flushflag = NVFalse;
-                        }
-
-                      id.recordID = GSF_RECORD_SWATH_BATHYMETRY_PING;
-                      id.record_number = aping[i];
-
-                      if (gsfRead (hnd, GSF_RECORD_SWATH_BATHYMETRY_PING, &id, &gsf_record, NULL, 0) < 0)
-                        {
-                          gsfPrintError (stderr);
-                          exit (-1);
-                        }
-                      prev_ping = aping[i];
-                    }
- 
-                  gsf_record.mb_ping.beam_flags[abeam[i]] |= NV_GSF_IGNORE_FILTER_EDITED;
-                  flushflag = NVTrue;
-                }
-            }
-        }
+  if (!simd_select (isa, precision, lane_sums))
+    {
+      fprintf (stderr, "Instruction set %s is not supported on this processor\n\n", isa);
+      exit (-1);
+    }
 
 
-      /*  If we need to flush the last ping, write it out.  */
+  /*  Everything left on the command line is a file name (or wildcard pattern).  */
 
-      if (flushflag)
-        {
-          id.recordID = GSF_RECORD_SWATH_BATHYMETRY_PING;
-          id.record_number = prev_ping;
-          if (gsfWrite(hnd, &id, &gsf_record) < 0)
-            {
-              gsfPrintError (stderr);
-              exit (-1);
-            }
-        }
+  for (i = optind ; i < argc ; i++) batch_add_files (&batch, argv[i]);
 
 
-      /*  Free the depth, ping, and beam memory.  */
+  /* Make sure we got at least one file.  */
 
-      free (adep);
-      adep = NULL;
-      free (aping);
-      aping = NULL;
-      free (abeam);
-      abeam = NULL;
+  if (!batch.files)
+    {
+      usage ();
+      exit (-1);
+    }
 
 
-      /*  Free the grid memory.  */
+  printf ("Kernels : %s\n\n", simd_name ());
 
-      if (count)
-        {
-          for (i = 0 ; i < grid_height ; i++)
-            {
-              for (j = 0 ; j < grid_width ; j++)
-                {
-                  if (grid[i][j].count) free (grid[i][j].depths);
-                }
-              free (grid[i]);
-            }
-          free (grid);
-        }
-            
 
-      if (!skipflag) start_rec += page_size;
-    }
+  /*  The filter thread pool lives for the whole run and is shared by all of the files being filtered.  */
 
+  if ((pool = thread_pool_create (threads)) == NULL) exit (-1);
 
-  percent = gsfPercent (hnd);
-  printf ("%3d%% processed    \n", percent);
-  gsfClose(hnd);
-  printf("\n");
-         
 
+  /*  getopt_long moves the file names to the end so argv[0] through argv[optind - 1] are the program and the
+      options (see batch_history).  */
 
-  /*  Open the file non-indexed so that we can write a history record.  */
+  batch.argc = optind;
+  batch.argv = argv;
+  batch.memory = memory * 1048576.0;
+  batch.options.page_size = PINGS_PER_PAGE;
+  batch.options.depth = depth;
+  batch.options.params.std_env = std_env;
+  batch.options.params.deep = deepflag;
+  batch.options.params.jacobi = jacobi;
+  batch.options.params.passes = passes;
+  batch.options.params.radius = radius;
+  batch.options.params.pool = pool;
+  batch.options.jacobi_check = jacobi_check;
 
-  if (gsfOpen (file, GSF_UPDATE, &hnd))
-    {
-      gsfPrintError (stderr);
-      exit (-1);
-    }
 
+  run_batch (&batch);
 
-  /*  Write a history record describing the filter process.  */
 
-  if (deepflag)
-    {
-      sprintf (comment, 
-               "This file was statistically filtered using the following program and arguments:\n%s -std %.1f -d %s\n",
-               argv[0], std_env, file);
-    }
-  else
-    {
-      sprintf (comment, 
-               "This file was statistically filtered using the following program and arguments:\n%s -std %.1f %s\n",
-               argv[0], std_env, file);
-    }
+  thread_pool_destroy (pool);
 
-  ret = write_history (argc, argv, comment, file, hnd);
-  if (ret)
-    {
-      fprintf(stderr, "Error: %d - writing gsf history record\n", ret);
-    }
+  if (batch.options.profile != NULL) fclose (batch.options.profile);
 
-  gsfClose (hnd);
+  for (i = 0 ; i < batch.files ; i++) free (batch.file[i]);
+  free (batch.file);
 
 
   return (0);
@@ -0,0 +1,858 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+
+#include "gsf_filter.h"
+
+
+extern int32_t gsfError;
+
+
+/*  Allocate a page with room for page_size pings.  The ping record copies have to be zeroed prior to the first
+    call to gsfCopyRecords.  */
+
+PAGE *page_alloc (int32_t page_size)
+{
+  PAGE *page;
+
+
+  page = (PAGE *) calloc (1, sizeof (PAGE));
+  if (page == NULL)
+    {
+      perror ("Allocating page memory");
+      exit (-1);
+    }
+
+  page->valid = (uint8_t *) calloc (page_size, sizeof (uint8_t));
+  page->dirty = (uint8_t *) calloc (page_size, sizeof (uint8_t));
+  page->mapped = (uint8_t *) calloc (page_size, sizeof (uint8_t));
+  page->flag_offset = (size_t *) calloc (page_size, sizeof (size_t));
+  page->dirty_lo = (int32_t *) calloc (page_size, sizeof (int32_t));
+  page->dirty_hi = (int32_t *) calloc (page_size, sizeof (int32_t));
+  page->ping_rec = (gsfRecords *) calloc (page_size, sizeof (gsfRecords));
+  if (page->valid == NULL || page->dirty == NULL || page->mapped == NULL || page->flag_offset == NULL ||
+      page->dirty_lo == NULL || page->dirty_hi == NULL || page->ping_rec == NULL)
+    {
+      perror ("Allocating ping record memory");
+      exit (-1);
+    }
+
+  return (page);
+}
+
+
+
+void page_free (PAGE *page, int32_t page_size)
+{
+  int32_t i;
+
+
+  for (i = 0 ; i < page_size ; i++) gsfFree (&page->ping_rec[i]);
+
+  free (page->ping_rec);
+  free (page->valid);
+  free (page->dirty);
+  free (page->mapped);
+  free (page->flag_offset);
+  free (page->dirty_lo);
+  free (page->dirty_hi);
+  free (page);
+}
+
+
+
+/*  Get the GSF handle for writing pings.  With --fast_read the file isn't opened with the GSF library at all (so
+    no index is built) unless a ping has to be written with gsfWrite, so we open it the first time we need it.  */
+
+int32_t gsf_write_hnd (PIPELINE *pipeline)
+{
+  if (pipeline->write_hnd < 0)
+    {
+      gsf_lock ();
+
+      if (gsfOpen (pipeline->file, GSF_UPDATE_INDEX, &pipeline->write_hnd))
+        {
+          gsfPrintError (stderr);
+          exit (-1);
+        }
+
+      gsf_unlock ();
+    }
+
+  return (pipeline->write_hnd);
+}
+
+
+
+/*  --fast_read couldn't decode ping record (see gsf_map.c) so we drop the map and read the rest of the file with
+    gsfRead.  */
+
+static void map_fallback (PIPELINE *pipeline, int32_t record)
+{
+  fprintf (stderr, "\nCan't decode ping %d of %s in the memory map, reading it with gsfRead\n", record,
+           pipeline->file);
+
+  gsf_map_close (&pipeline->map);
+
+
+  gsf_lock ();
+
+  if (pipeline->read_hnd < 0 && gsfOpen (pipeline->file, GSF_READONLY_INDEX, &pipeline->read_hnd))
+    {
+      gsfPrintError (stderr);
+      exit (-1);
+    }
+
+  gsf_unlock ();
+}
+
+
+
+/*  Compare a ping read through the memory map with the same ping read by gsfRead (--fast_read_check).  */
+
+static void map_check (PIPELINE *pipeline, int32_t record, gsfSwathBathyPing *ping)
+{
+  gsfDataID           id;
+  gsfRecords          gsf_record;
+
+
+  id.recordID = GSF_RECORD_SWATH_BATHYMETRY_PING;
+  id.record_number = record;
+
+
+  gsf_lock ();
+
+  if (gsfRead (pipeline->read_hnd, GSF_RECORD_SWATH_BATHYMETRY_PING, &id, &gsf_record, NULL, 0) < 0 ||
+      !gsf_map_same (ping, &gsf_record.mb_ping)) pipeline->map_differ++;
+
+  gsf_unlock ();
+
+  pipeline->map_checked++;
+}
+
+
+
+/*  Read "page_size" pings (or up to the first position jump) into the page.  We keep a copy of every valid ping so
+    that the worker can georeference it and so that we don't have to read (and decode) the ping a second time
+    when we write the filter flags back.  With --fast_read the pings are decoded straight into the page from the
+    memory map instead of being read by gsfRead and copied.  */
+
+void read_page (PIPELINE *pipeline, PAGE *page)
+{
+  gsfDataID           id;
+  gsfRecords          gsf_record;
+  gsfSwathBathyPing   *ping;
+  int32_t             j, slot, status;
+  double              lat, lon, dx, az, start = 0.0;
+  uint8_t             skipflag = NVFalse, locked;
+
+
+  if (pipeline->timing) start = stage_clock ();
+
+  memset (&page->profile, 0, sizeof (PAGE_PROFILE));
+  page->page_start = pipeline->start_rec;
+  page->start_lat = pipeline->prev_lat;
+  page->start_lon = pipeline->prev_lon;
+  page->pings = 0;
+  page->last = NVFalse;
+  page->jump = NVFalse;
+  memset (page->valid, 0, pipeline->page_size);
+  memset (page->dirty, 0, pipeline->page_size);
+  memset (page->mapped, 0, pipeline->page_size);
+  memset (page->flag_offset, 0, pipeline->page_size * sizeof (size_t));
+
+
+  for (j = pipeline->start_rec ; j < pipeline->start_rec + pipeline->page_size ; j++)
+    {
+      slot = j - page->page_start;
+      ping = NULL;
+
+
+      if (pipeline->map.base != NULL)
+        {
+          status = gsf_map_read (&pipeline->map, j, &page->ping_rec[slot].mb_ping);
+
+          if (!status)
+            {
+              page->last = NVTrue;
+              break;
+            }
+
+          if (status > 0)
+            {
+              ping = &page->ping_rec[slot].mb_ping;
+              page->mapped[slot] = NVTrue;
+              page->flag_offset[slot] = pipeline->map.flag_offset;
+              if (pipeline->fast_read_check)
+                {
+                  map_check (pipeline, j, ping);
+                  pipeline->map_checksums += pipeline->map.checksum;
+                }
+            }
+          else
+            {
+              map_fallback (pipeline, j);
+            }
+        }
+
+
+      /*  The GSF library is locked until we've copied the ping.  */
+
+      locked = (ping == NULL);
+
+      if (locked)
+        {
+          id.recordID = GSF_RECORD_SWATH_BATHYMETRY_PING;
+          id.record_number = j;
+
+
+          gsf_lock ();
+
+          if (gsfRead (pipeline->read_hnd, GSF_RECORD_SWATH_BATHYMETRY_PING, &id, &gsf_record, NULL, 0) < 0)
+            {
+              page->last = NVTrue;
+
+              if (gsfError != GSF_INVALID_RECORD_NUMBER) gsfPrintError(stderr);
+              gsf_unlock ();
+              break;
+            }
+
+          ping = &gsf_record.mb_ping;
+        }
+
+
+      lat = ping->latitude;
+      lon = ping->longitude;
+
+
+      /*  Only deal with valid pings.  */
+
+      if ((lat <= 90.0) && (lon <= 180.0) && !(ping->ping_flags & GSF_IGNORE_PING))
+        {
+          /*  If we jumped more than 1000 meters we want to close this page and then start over with this
+              record.  */
+
+          invgp (NV_A0, NV_B0, lat, lon, pipeline->prev_lat, pipeline->prev_lon, &dx, &az);
+          if (pipeline->prev_lat > -900.0 && dx > 1000.0)
+            {
+              pipeline->start_rec = j;
+              skipflag = NVTrue;
+
+
+              /*  Forget the previous position so that the next page doesn't see the same jump again.  */
+
+              pipeline->prev_lat = -999.0;
+              if (locked) gsf_unlock ();
+              break;
+            }
+          pipeline->prev_lat = lat;
+          pipeline->prev_lon = lon;
+
+
+          if (locked && gsfCopyRecords (&page->ping_rec[slot], &gsf_record))
+            {
+              gsfPrintError (stderr);
+              exit (-1);
+            }
+          page->valid[slot] = NVTrue;
+        }
+
+      if (locked) gsf_unlock ();
+
+      page->pings = slot + 1;
+    }
+
+
+  if (pipeline->map.base != NULL)
+    {
+      page->percent = gsf_map_percent (&pipeline->map);
+    }
+  else
+    {
+      gsf_lock ();
+      page->percent = gsfPercent (pipeline->read_hnd);
+      gsf_unlock ();
+    }
+
+
+  page->jump = skipflag;
+  if (!skipflag) pipeline->start_rec += pipeline->page_size;
+
+  page->next_rec = pipeline->start_rec;
+  page->end_lat = pipeline->prev_lat;
+  page->end_lon = pipeline->prev_lon;
+
+
+  if (pipeline->timing) page->profile.decode = stage_clock () - start;
+}
+
+
+
+/*  What we need to know about the points of a page to grid them.  */
+
+typedef struct
+{
+  NV_F64_XYMBR        mbr;
+  double              sum_z;
+  double              sum_sin;              /*  Sums of the sines and cosines of the headings of the pings with  */
+  double              sum_cos;              /*  points in them, for the mean heading  */
+} PAGE_EXTENT;
+
+
+
+/*  Georeference the valid beams of one ping and add them to the point buffer.  Returns the new point count.  */
+
+static int32_t load_ping (PIPELINE *pipeline, gsfSwathBathyPing *ping, int32_t record, int32_t count,
+                          PAGE_EXTENT *extent)
+{
+  NV_F64_XYMBR        *mbr = &extent->mbr;
+  int32_t             first = count;
+  int32_t             i;
+  float               dep;
+  double              lateral, ang1, ang2, lat, lon, dn, de, dev;
+  NV_F64_COORD2       xy2, nxy;
+  LTP_FRAME           frame;
+  POINT_BUF           *points = &pipeline->points;
+
+
+  lat = ping->latitude;
+  lon = ping->longitude;
+
+  ang1 = ping->heading + 90.0;
+  ang2 = ping->heading;
+
+
+  /*  With fast georeferencing we do all of the beams in the ping at once.  */
+
+  if (pipeline->fast_georef)
+    {
+      if (ping->number_beams > pipeline->beam_size)
+        {
+          pipeline->beam_size = ping->number_beams;
+          pipeline->beam_lat = (double *) realloc (pipeline->beam_lat, pipeline->beam_size * sizeof (double));
+          pipeline->beam_lon = (double *) realloc (pipeline->beam_lon, pipeline->beam_size * sizeof (double));
+          if (pipeline->beam_lat == NULL || pipeline->beam_lon == NULL)
+            {
+              perror ("Allocating beam position memory");
+              exit (-1);
+            }
+        }
+
+      ltp_frame (lat, lon, ping->heading, &frame);
+      ltp_beams (&frame, ping->across_track, ping->along_track, ping->number_beams, pipeline->beam_lat,
+                 pipeline->beam_lon);
+    }
+
+
+  for (i = 0 ; i < ping->number_beams ; i++) 
+    {
+      dep = ping->depth[i];
+      if (dep == 0.0 && ping->nominal_depth != NULL) dep = ping->nominal_depth[i];
+
+
+      /*  Only deal with valid beams.  */
+
+      if (dep != 0.0 && ping->beam_flags != NULL && 
+          !(check_flag (ping->beam_flags[i], NV_GSF_IGNORE_NULL_BEAM)) &&
+          !(check_flag (ping->beam_flags[i], (NV_GSF_IGNORE_MANUALLY_EDITED | NV_GSF_IGNORE_FILTER_EDITED)))) 
+        {
+          if (!pipeline->fast_georef || pipeline->georef_check)
+            {
+              /*  Adjust for cross track position.  */
+
+              lateral = ping->across_track[i];
+              newgp (lat, lon, ang1, lateral, &nxy.y, &nxy.x);
+
+
+              /*  if the along track array is present then use it  */
+            
+              if (ping->along_track != (double *) NULL) 
+                {
+                  xy2.y = nxy.y;
+                  xy2.x = nxy.x;
+                  lateral = ping->along_track[i];
+
+                  newgp (xy2.y, xy2.x, ang2, lateral, &nxy.y, &nxy.x);
+                }
+            }
+
+
+          if (pipeline->fast_georef)
+            {
+              /*  Keep track of the largest difference from newgp (in meters).  */
+
+              if (pipeline->georef_check)
+                {
+                  dn = (pipeline->beam_lat[i] - nxy.y) / frame.ky;
+                  de = (pipeline->beam_lon[i] - nxy.x) / frame.kx;
+                  dev = sqrt (dn * dn + de * de);
+                  if (dev > pipeline->georef_max) pipeline->georef_max = dev;
+                }
+
+              nxy.y = pipeline->beam_lat[i];
+              nxy.x = pipeline->beam_lon[i];
+            }
+
+
+          /*  Make sure we have room for the point (this only reallocates when the buffer doubles).  */
+
+          if (count == points->size) point_buf_grow (points, count + 1);
+
+
+          /*  Save the point and compute the mbr.  */
+
+          points->lat[count] = nxy.y;
+          points->lon[count] = nxy.x;
+          points->dep[count] = dep;
+          points->ping[count] = record;
+          points->beam[count] = i;
+
+          if (points->lat[count] < mbr->min_y) mbr->min_y = points->lat[count];
+          if (points->lat[count] > mbr->max_y) mbr->max_y = points->lat[count];
+          if (points->lon[count] < mbr->min_x) mbr->min_x = points->lon[count];
+          if (points->lon[count] > mbr->max_x) mbr->max_x = points->lon[count];
+          extent->sum_z += points->dep[count];
+
+          count++;
+        }
+    }
+
+
+  if (count != first)
+    {
+      extent->sum_sin += sin (ping->heading * M_PI / 180.0);
+      extent->sum_cos += cos (ping->heading * M_PI / 180.0);
+    }
+
+
+  return (count);
+}
+
+
+
+/*  Georeference the valid beams of the pings in a page into the point buffer without filtering them (for the
+    survey tiles, see survey.c).  Returns the number of points.  */
+
+int32_t page_points (PIPELINE *pipeline, PAGE *page)
+{
+  int32_t             j, count;
+  PAGE_EXTENT         extent;
+
+
+  count = 0;
+  extent.mbr.min_x = 999.0;
+  extent.mbr.max_x = -999.0;
+  extent.mbr.min_y = 999.0;
+  extent.mbr.max_y = -999.0;
+  extent.sum_z = 0.0;
+  extent.sum_sin = 0.0;
+  extent.sum_cos = 0.0;
+
+  for (j = 0 ; j < page->pings ; j++)
+    {
+      if (page->valid[j])
+        count = load_ping (pipeline, &page->ping_rec[j].mb_ping, page->page_start + j, count, &extent);
+    }
+
+  return (count);
+}
+
+
+
+/*  Georeference the beams of a page, grid them, and filter them.  The filter flags are set in the page's ping
+    record copies and the pings that were changed are marked dirty for write_page.
+
+    If pipeline->halo is set, the last halo pings of the previous page and the first halo pings of the next page
+    are gridded along with the page so that the cells at the ends of the page have all of their neighbors.  The
+    halo points take part in the statistics (and may be dropped from them as outliers) but they are never flagged
+    here.  Each of them gets flagged (or not) when its own page is filtered.  The previous page has already been
+    filtered so the points it flagged are left out of the halo.  We don't use a halo across a position jump.  prev
+    and next may be NULL.  */
+
+void filter_page (PIPELINE *pipeline, PAGE *prev, PAGE *page, PAGE *next)
+{
+  int32_t             i, j, k, b, count, page_count;
+  float               avg_z;
+  double              start = 0.0, now;
+  double              sum_z, rlat1, rlon1, heading, dn, de, *x, *y;
+  NV_F64_XYMBR        mbr;
+  GRID_LAYOUT         layout;
+  PAGE_EXTENT         extent;
+  LTP_FRAME           frame;
+  uint8_t             *classic_flags;
+  GRID                grid;
+  POINT_BUF           *points = &pipeline->points;
+  ARENA               *arena = &pipeline->arena;
+  FILTER_PARAMS       *params = &pipeline->params;
+
+
+  count = 0;
+  extent.mbr.min_x = 999.0;
+  extent.mbr.max_x = -999.0;
+  extent.mbr.min_y = 999.0;
+  extent.mbr.max_y = -999.0;
+  extent.sum_z = 0.0;
+  extent.sum_sin = 0.0;
+  extent.sum_cos = 0.0;
+  arena_reset (arena);
+
+  if (pipeline->timing) start = stage_clock ();
+
+
+  /*  Load the valid beams into the point buffer, halo pings and all.  */
+
+  if (pipeline->halo && prev != NULL && !prev->jump)
+    {
+      for (j = MAX (0, prev->pings - pipeline->halo) ; j < prev->pings ; j++)
+        {
+          if (prev->valid[j])
+            count = load_ping (pipeline, &prev->ping_rec[j].mb_ping, prev->page_start + j, count, &extent);
+        }
+    }
+
+  page_count = count;
+  for (j = 0 ; j < page->pings ; j++)
+    {
+      if (page->valid[j])
+        count = load_ping (pipeline, &page->ping_rec[j].mb_ping, page->page_start + j, count, &extent);
+    }
+  page_count = count - page_count;
+
+  if (pipeline->halo && next != NULL && !page->jump)
+    {
+      for (j = 0 ; j < MIN (pipeline->halo, next->pings) ; j++)
+        {
+          if (next->valid[j])
+            count = load_ping (pipeline, &next->ping_rec[j].mb_ping, next->page_start + j, count, &extent);
+        }
+    }
+
+
+  /*  If we didn't get any points there's nothing to do.  */
+
+  page->profile.soundings = page_count;
+
+  if (pipeline->timing)
+    {
+      now = stage_clock ();
+      page->profile.georef = now - start;
+      start = now;
+    }
+
+
+  if (!count) return;
+
+
+  mbr = extent.mbr;
+  sum_z = extent.sum_z;
+
+
+  /*  Average depth.  */
+
+  avg_z = (float) sum_z / (float) count;
+
+
+  rlat1 = mbr.min_y + (mbr.max_y - mbr.min_y) / 2.0;
+  rlon1 = mbr.min_x + (mbr.max_x - mbr.min_x) / 2.0;
+
+
+  if (pipeline->rotate)
+    {
+      /*  Bin the points in a metric frame centered on the page and rotated to the mean heading (the circular mean
+          of the ping headings) so that the rows run along the track.  On diagonal lines this fills the grid
+          rectangle with the swath instead of leaving most of it empty.  */
+
+      heading = atan2 (extent.sum_sin, extent.sum_cos) * 180.0 / M_PI;
+      ltp_frame (rlat1, rlon1, heading, &frame);
+
+      x = (double *) arena_alloc (arena, count * sizeof (double));
+      y = (double *) arena_alloc (arena, count * sizeof (double));
+
+      mbr.min_x = mbr.min_y = 1.0e30;
+      mbr.max_x = mbr.max_y = -1.0e30;
+
+      for (i = 0 ; i < count ; i++)
+        {
+          de = (points->lon[i] - rlon1) / frame.kx;
+          dn = (points->lat[i] - rlat1) / frame.ky;
+
+          x[i] = de * frame.across_x + dn * frame.across_y;
+          y[i] = de * frame.along_x + dn * frame.along_y;
+
+          mbr.min_x = MIN (mbr.min_x, x[i]);
+          mbr.max_x = MAX (mbr.max_x, x[i]);
+          mbr.min_y = MIN (mbr.min_y, y[i]);
+          mbr.max_y = MAX (mbr.max_y, y[i]);
+        }
+    }
+  else
+    {
+      x = points->lon;
+      y = points->lat;
+    }
+
+  if (pipeline->timing)
+    {
+      now = stage_clock ();
+      page->profile.georef += now - start;
+    }
+
+
+  /*  Grid and filter the points (see grid.c).  If we're checking the Jacobi filter against the normal filter,
+      grid_filter runs the normal filter first and saves its flags in classic_flags.  */
+
+  classic_flags = NULL;
+  if (pipeline->jacobi_check) classic_flags = (uint8_t *) arena_alloc (arena, count);
+
+  grid_filter (&grid, &layout, arena, x, y, points->dep, count, &mbr, avg_z, pipeline->rotate, params,
+               (pipeline->timing ? &page->profile : NULL), classic_flags);
+
+  if (pipeline->timing) start = stage_clock ();
+
+  pipeline->max_passes = MAX (pipeline->max_passes, grid.passes);
+  pipeline->touched += grid.touched;
+
+
+  if (pipeline->jacobi_check)
+    {
+      for (k = 0 ; k < count ; k++)
+        {
+          j = points->ping[grid.index[k]] - page->page_start;
+          if (j < 0 || j >= page->pings) continue;
+
+          if (classic_flags[k]) pipeline->classic_total++;
+
+          if (grid.filtered[k] != classic_flags[k])
+            {
+              if (grid.filtered[k])
+                {
+                  pipeline->jacobi_only++;
+                }
+              else
+                {
+                  pipeline->classic_only++;
+                }
+            }
+        }
+    }
+
+
+  /*  Set the filter flags in the ping record copies and mark the pings that we changed (skipping the halo).  */
+
+  for (k = 0 ; k < count ; k++)
+    {
+      i = grid.index[k];
+      j = points->ping[i] - page->page_start;
+
+      if (grid.filtered[k] && j >= 0 && j < page->pings)
+        {
+          b = points->beam[i];
+
+          page->ping_rec[j].mb_ping.beam_flags[b] |= NV_GSF_IGNORE_FILTER_EDITED;
+
+          if (!page->dirty[j])
+            {
+              page->dirty_lo[j] = page->dirty_hi[j] = b;
+            }
+          else
+            {
+              page->dirty_lo[j] = MIN (page->dirty_lo[j], b);
+              page->dirty_hi[j] = MAX (page->dirty_hi[j], b);
+            }
+
+          page->dirty[j] = NVTrue;
+          page->profile.filtered++;
+        }
+    }
+
+  if (pipeline->timing) page->profile.filter += stage_clock () - start;
+}
+
+
+
+/*  Write one JSON line describing the page to the --profile file.  The line goes out in a single fprintf so the
+    lines from files being filtered at the same time don't get mixed together.  */
+
+static void write_profile (PIPELINE *pipeline, PAGE *page)
+{
+  char                name[2048], *ptr;
+  int32_t             i;
+  PAGE_PROFILE        *prof = &page->profile;
+
+
+  /*  The file name is the only string so it's the only thing that needs escaping.  */
+
+  for (ptr = pipeline->file, i = 0 ; *ptr && i < (int32_t) sizeof (name) - 7 ; ptr++)
+    {
+      if (*ptr == '"' || *ptr == '\\')
+        {
+          name[i++] = '\\';
+          name[i++] = *ptr;
+        }
+      else if ((unsigned char) *ptr < 0x20)
+        {
+          i += sprintf (&name[i], "\\u%04x", (unsigned char) *ptr);
+        }
+      else
+        {
+          name[i++] = *ptr;
+        }
+    }
+  name[i] = 0;
+
+
+  fprintf (pipeline->profile, "{\"file\": \"%s\", \"page_start\": %d, \"pings\": %d, \"soundings\": %d, "
+           "\"grid_height\": %d, \"grid_width\": %d, \"grid_size\": %.9g, \"coarsened\": %d, \"cells\": %d, "
+           "\"filtered\": %d, \"rewritten\": %d, \"passes\": %d, \"touched\": %d, \"decode\": %.6f, "
+           "\"georef\": %.6f, \"bin\": %.6f, \"stats\": %.6f, \"filter\": %.6f, \"write\": %.6f}\n", name,
+           page->page_start, page->pings, prof->soundings, prof->grid_height, prof->grid_width, prof->grid_size,
+           prof->coarsened, prof->cells, prof->filtered, prof->rewritten, prof->passes, prof->touched, prof->decode,
+           prof->georef, prof->bin, prof->stats, prof->filter, prof->write);
+}
+
+
+
+/*  Write a changed ping that was decoded from the memory map but can't be patched in place (it has a checksum).
+    The decoded ping is missing everything gsf_map.c skipped, so we read the whole record with gsfRead, copy the
+    beam flags that the worker changed into it, and write that.  */
+
+static void write_mapped_ping (PIPELINE *pipeline, PAGE *page, int32_t j)
+{
+  gsfDataID           id;
+  gsfRecords          gsf_record;
+  gsfSwathBathyPing   *ping = &page->ping_rec[j].mb_ping;
+  int32_t             hnd;
+
+
+  id.recordID = GSF_RECORD_SWATH_BATHYMETRY_PING;
+  id.record_number = page->page_start + j;
+
+  hnd = gsf_write_hnd (pipeline);
+
+  gsf_lock ();
+
+  if (gsfRead (hnd, GSF_RECORD_SWATH_BATHYMETRY_PING, &id, &gsf_record, NULL, 0) < 0)
+    {
+      gsfPrintError (stderr);
+      exit (-1);
+    }
+
+  if (gsf_record.mb_ping.number_beams != ping->number_beams || gsf_record.mb_ping.beam_flags == NULL)
+    {
+      fprintf (stderr, "Record %d of %s doesn't match the memory map\n", id.record_number, pipeline->file);
+      exit (-1);
+    }
+
+  memcpy (&gsf_record.mb_ping.beam_flags[page->dirty_lo[j]], &ping->beam_flags[page->dirty_lo[j]],
+          page->dirty_hi[j] - page->dirty_lo[j] + 1);
+
+  if (gsfWrite (hnd, &id, &gsf_record) < 0)
+    {
+      gsfPrintError (stderr);
+      exit (-1);
+    }
+
+  gsf_unlock ();
+}
+
+
+
+/*  Write the changed pings of a page back to the GSF file (or their flags to the sidecar file).  The pings are
+    written in record order so we never bounce around the file.  */
+
+void write_page (PIPELINE *pipeline, PAGE *page)
+{
+  gsfDataID           id;
+  int32_t             j, hnd;
+  double              start = 0.0;
+
+
+  if (pipeline->timing) start = stage_clock ();
+
+  if (pipeline->checkpoint) checkpoint_write (pipeline, page);
+
+  for (j = 0 ; j < page->pings ; j++)
+    {
+      if (page->dirty[j])
+        {
+          if (pipeline->sidecar)
+            {
+              sidecar_ping (pipeline, &page->ping_rec[j].mb_ping, page->page_start + j);
+            }
+          else if (page->flag_offset[j] && pipeline->patch_fd >= 0)
+            {
+              gsf_patch_flags (pipeline->patch_fd, pipeline->file, page->flag_offset[j] + page->dirty_lo[j],
+                               &page->ping_rec[j].mb_ping.beam_flags[page->dirty_lo[j]],
+                               page->dirty_hi[j] - page->dirty_lo[j] + 1);
+            }
+          else if (page->mapped[j])
+            {
+              write_mapped_ping (pipeline, page, j);
+            }
+          else
+            {
+              id.recordID = GSF_RECORD_SWATH_BATHYMETRY_PING;
+              id.record_number = page->page_start + j;
+
+              hnd = gsf_write_hnd (pipeline);
+
+              gsf_lock ();
+
+              if (gsfWrite (hnd, &id, &page->ping_rec[j]) < 0)
+                {
+                  gsfPrintError (stderr);
+                  exit (-1);
+                }
+
+              gsf_unlock ();
+            }
+
+          page->profile.rewritten++;
+        }
+    }
+
+  if (pipeline->timing)
+    {
+      page->profile.write = stage_clock () - start;
+
+
+      /*  The writer is the last stage to see the page so it adds the page to the totals.  */
+
+      if (pipeline->times != NULL)
+        {
+          pipeline->times->decode += page->profile.decode;
+          pipeline->times->georef += page->profile.georef;
+          pipeline->times->bin += page->profile.bin;
+          pipeline->times->stats += page->profile.stats;
+          pipeline->times->filter += page->profile.filter;
+          pipeline->times->write += page->profile.write;
+          pipeline->times->pings += page->pings;
+          pipeline->times->soundings += page->profile.soundings;
+        }
+
+      if (pipeline->profile != NULL) write_profile (pipeline, page);
+    }
+
+
+  batch_progress (pipeline->batch, pipeline->file_num, page->percent);
+}
@@ -0,0 +1,379 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+
+#include "gsf_filter.h"
+
+
+/*  The GSF library keeps its error state (and some of its decoding state) in globals so only one thread at a time
+    may be inside it.  Every GSF call that can happen while the pipeline is running goes through this lock.  */
+
+static pthread_mutex_t gsf_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+void gsf_lock ()
+{
+  pthread_mutex_lock (&gsf_mutex);
+}
+
+
+
+void gsf_unlock ()
+{
+  pthread_mutex_unlock (&gsf_mutex);
+}
+
+
+
+static void page_queue_init (PAGE_QUEUE *queue, int32_t size)
+{
+  queue->page = (PAGE **) calloc (size, sizeof (PAGE *));
+  if (queue->page == NULL)
+    {
+      perror ("Allocating page queue memory");
+      exit (-1);
+    }
+
+  queue->size = size;
+  queue->head = 0;
+  queue->count = 0;
+
+  pthread_mutex_init (&queue->mutex, NULL);
+  pthread_cond_init (&queue->not_empty, NULL);
+  pthread_cond_init (&queue->not_full, NULL);
+}
+
+
+
+static void page_queue_destroy (PAGE_QUEUE *queue)
+{
+  pthread_mutex_destroy (&queue->mutex);
+  pthread_cond_destroy (&queue->not_empty);
+  pthread_cond_destroy (&queue->not_full);
+
+  free (queue->page);
+}
+
+
+
+static void page_queue_put (PAGE_QUEUE *queue, PAGE *page)
+{
+  pthread_mutex_lock (&queue->mutex);
+
+  while (queue->count == queue->size) pthread_cond_wait (&queue->not_full, &queue->mutex);
+
+  queue->page[(queue->head + queue->count) % queue->size] = page;
+  queue->count++;
+
+  pthread_cond_signal (&queue->not_empty);
+  pthread_mutex_unlock (&queue->mutex);
+}
+
+
+
+static PAGE *page_queue_get (PAGE_QUEUE *queue)
+{
+  PAGE *page;
+
+
+  pthread_mutex_lock (&queue->mutex);
+
+  while (!queue->count) pthread_cond_wait (&queue->not_empty, &queue->mutex);
+
+  page = queue->page[queue->head];
+  queue->head = (queue->head + 1) % queue->size;
+  queue->count--;
+
+  pthread_cond_signal (&queue->not_full);
+  pthread_mutex_unlock (&queue->mutex);
+
+  return (page);
+}
+
+
+
+/*  The stages are connected like this:
+
+        free --> reader --> filled --> worker --> filtered --> writer --> free
+
+    filled and filtered hold at most "depth" pages each.  We allocate 2 * depth + 3 pages (one being read, one being
+    filtered, one being written, and the queued pages) so a stage only ever waits on the bounded queues, never
+    for a free page.  With a halo the worker holds on to two more pages (see filter_stage).  The last page of the
+    file is passed all the way down the line and shuts each stage down as it goes by.  */
+
+typedef struct
+{
+  PIPELINE            *pipeline;
+  PAGE_QUEUE          free;
+  PAGE_QUEUE          filled;
+  PAGE_QUEUE          filtered;
+  PAGE                *prev;
+  PAGE                *cur;
+  PAGE                *seed;                /*  Page read back in when resuming, only used as a halo  */
+} STAGES;
+
+
+
+static void *reader (void *arg)
+{
+  STAGES *stages = (STAGES *) arg;
+  PAGE *page;
+  uint8_t last;
+
+
+  do
+    {
+      page = page_queue_get (&stages->free);
+      read_page (stages->pipeline, page);
+
+      last = page->last;
+      page_queue_put (&stages->filled, page);
+    } while (!last);
+
+  return (NULL);
+}
+
+
+
+static void *writer (void *arg)
+{
+  STAGES *stages = (STAGES *) arg;
+  PAGE *page;
+  uint8_t last;
+
+
+  do
+    {
+      page = page_queue_get (&stages->filtered);
+      write_page (stages->pipeline, page);
+
+
+      /*  Once the page is back on the free list the reader may reuse it so we have to check last first.  */
+
+      last = page->last;
+      page_queue_put (&stages->free, page);
+    } while (!last);
+
+  return (NULL);
+}
+
+
+
+/*  Hand a filtered page to the writer (or just write it if we're running the stages in sequence).  */
+
+static void emit (STAGES *stages, PAGE *page)
+{
+  /*  The page we read back in when we resumed has already been written.  */
+
+  if (page == stages->seed)
+    {
+      stages->seed = NULL;
+      page_queue_put (&stages->free, page);
+      return;
+    }
+
+  if (stages->pipeline->depth)
+    {
+      page_queue_put (&stages->filtered, page);
+    }
+  else
+    {
+      write_page (stages->pipeline, page);
+      page_queue_put (&stages->free, page);
+    }
+}
+
+
+
+/*  Filter the pages in file order.  Without a halo each page is filtered and passed on as soon as it arrives.  With
+    a halo we can't filter a page until the next one has been read, and we can't let go of it until the page after
+    it has been filtered (since its last pings are that page's halo).  So we keep the previous and current pages
+    here, filter the current page when the next one arrives, and only then pass the previous page on.  Nothing is
+    decoded twice.  */
+
+static void filter_stage (STAGES *stages, PAGE *page)
+{
+  PIPELINE *pipeline = stages->pipeline;
+
+
+  if (!pipeline->halo)
+    {
+      filter_page (pipeline, NULL, page, NULL);
+      emit (stages, page);
+      return;
+    }
+
+
+  if (stages->cur != NULL)
+    {
+      filter_page (pipeline, stages->prev, stages->cur, page);
+
+      if (stages->prev != NULL) emit (stages, stages->prev);
+      stages->prev = stages->cur;
+    }
+
+  stages->cur = page;
+
+
+  /*  There's no next page for the last one.  */
+
+  if (page->last)
+    {
+      filter_page (pipeline, stages->prev, page, NULL);
+
+      if (stages->prev != NULL) emit (stages, stages->prev);
+      emit (stages, page);
+
+      stages->prev = stages->cur = NULL;
+    }
+}
+
+
+
+/*  Pick up from a checkpoint.  We read the last page that was written back in to make sure the file is the way we
+    left it, and with a halo we keep it as the previous page of the first page we filter.  Then we put the reader
+    back where it was after that page.  */
+
+static void resume (STAGES *stages)
+{
+  PIPELINE *pipeline = stages->pipeline;
+  PAGE *page;
+
+
+  page = page_queue_get (&stages->free);
+
+  pipeline->start_rec = pipeline->resume_from.page_start;
+  pipeline->prev_lat = pipeline->resume_from.start_lat;
+  pipeline->prev_lon = pipeline->resume_from.start_lon;
+  read_page (pipeline, page);
+
+  if (!checkpoint_verify (pipeline, page))
+    {
+      fprintf (stderr, "%s has changed since its checkpoint was written, remove %s.ckp to start over\n",
+               pipeline->file, pipeline->file);
+      exit (-1);
+    }
+
+  pipeline->start_rec = pipeline->resume_from.next_rec;
+  pipeline->prev_lat = pipeline->resume_from.lat;
+  pipeline->prev_lon = pipeline->resume_from.lon;
+
+  if (pipeline->halo && !page->jump)
+    {
+      stages->prev = stages->seed = page;
+    }
+  else
+    {
+      page_queue_put (&stages->free, page);
+    }
+}
+
+
+
+/*  Filter a file, one page at a time.  With a depth of 0 we just read, filter, and write each page in turn.
+    Otherwise the reader and writer get their own threads and the calling thread does the filtering so that we're
+    reading the next page and writing the previous one while we filter the current one.  The pages are processed
+    in the same order either way so the results are identical.  */
+
+void run_pipeline (PIPELINE *pipeline)
+{
+  STAGES              stages;
+  PAGE                *page, **pages;
+  pthread_t           read_thread, write_thread;
+  int32_t             i, page_count;
+  uint8_t             last;
+
+
+  page_count = pipeline->depth ? 2 * pipeline->depth + 3 : 1;
+  if (pipeline->halo) page_count += 2;
+
+  pages = (PAGE **) calloc (page_count, sizeof (PAGE *));
+  if (pages == NULL)
+    {
+      perror ("Allocating page memory");
+      exit (-1);
+    }
+
+
+  stages.pipeline = pipeline;
+  stages.prev = stages.cur = stages.seed = NULL;
+  page_queue_init (&stages.free, page_count);
+
+  for (i = 0 ; i < page_count ; i++)
+    {
+      pages[i] = page_alloc (pipeline->page_size);
+      page_queue_put (&stages.free, pages[i]);
+    }
+
+  if (pipeline->resume_from.page_start) resume (&stages);
+
+
+  if (!pipeline->depth)
+    {
+      do
+        {
+          page = page_queue_get (&stages.free);
+          read_page (pipeline, page);
+
+          last = page->last;
+          filter_stage (&stages, page);
+        } while (!last);
+    }
+  else
+    {
+      page_queue_init (&stages.filled, pipeline->depth);
+      page_queue_init (&stages.filtered, pipeline->depth);
+
+      if (pthread_create (&read_thread, NULL, reader, &stages) ||
+          pthread_create (&write_thread, NULL, writer, &stages))
+        {
+          perror ("Creating pipeline thread");
+          exit (-1);
+        }
+
+
+      do
+        {
+          page = page_queue_get (&stages.filled);
+
+
+          /*  The writer may hand the page back to the reader as soon as it has been passed on.  */
+
+          last = page->last;
+          filter_stage (&stages, page);
+        } while (!last);
+
+
+      pthread_join (read_thread, NULL);
+      pthread_join (write_thread, NULL);
+
+      page_queue_destroy (&stages.filled);
+      page_queue_destroy (&stages.filtered);
+    }
+
+
+  for (i = 0 ; i < page_count ; i++) page_free (pages[i], pipeline->page_size);
+  free (pages);
+
+  page_queue_destroy (&stages.free);
+}
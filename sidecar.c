@@ -0,0 +1,432 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+#include "gsf_filter.h"
+
+
+/*  Sidecar flag files.  With --sidecar the filter opens the GSF file read only and, instead of writing the changed
+    pings back, writes the filter flags of each changed ping to FILE.flg.  --apply then goes through the GSF file
+    once, in record order, and sets the flags (and writes the history record).  So a trial run doesn't change
+    anything and the filter run can simply be run again if it's stopped.  The sidecar is written to FILE.flg.tmp
+    and renamed when it's done so there is never a partial FILE.flg.
+
+    All of the numbers are little endian unsigned integers.
+
+        8 bytes        "GSFFLAGS"
+        4 bytes        format version (2)
+        8 bytes        size of the GSF file when it was filtered
+        2 bytes        length of the options text
+        options text   the filter options that change the flags, as they go in the history record (see
+                       filter_options), not zero terminated
+
+    then for each changed ping, in record order
+
+        4 bytes        record number (starting at 1)
+        2 bytes        number of beams
+        (beams + 7) / 8 bytes of flags, one bit per beam (bit b % 8 of byte b / 8), set if the beam is filtered
+
+    and at the end
+
+        4 bytes        0
+        4 bytes        number of pings
+
+    Version 1 had the standard deviations * 1000 (4 bytes) and 1 for the deep filter (1 byte) instead of the
+    options text.  Those can still be applied.
+
+    The size of the GSF file is checked before a sidecar is applied.  Applying adds a history record to the file
+    so a sidecar can't accidentally be applied twice.  If a ping doesn't match its flags the apply stops there,
+    without a history record, and goes on to the next file.  */
+
+#define SIDECAR_MAGIC         "GSFFLAGS"
+#define SIDECAR_VERSION       2
+
+
+static void sidecar_name (char *file, char *name, uint8_t tmp)
+{
+  snprintf (name, 2048, tmp ? "%s.flg.tmp" : "%s.flg", file);
+}
+
+
+
+static void put_uint (FILE *fp, uint64_t value, int32_t bytes)
+{
+  int32_t i;
+
+
+  for (i = 0 ; i < bytes ; i++) fputc ((int) ((value >> (i * 8)) & 0xff), fp);
+}
+
+
+
+static uint8_t get_uint (FILE *fp, uint64_t *value, int32_t bytes)
+{
+  int32_t i, c;
+
+
+  *value = 0;
+  for (i = 0 ; i < bytes ; i++)
+    {
+      if ((c = fgetc (fp)) == EOF) return (NVFalse);
+
+      *value |= (uint64_t) c << (i * 8);
+    }
+
+  return (NVTrue);
+}
+
+
+
+/*  Start the sidecar for the file in the pipeline.  */
+
+void sidecar_open (PIPELINE *pipeline)
+{
+  char                name[2048], options[FILTER_OPTIONS];
+
+
+  sidecar_name (pipeline->file, name, NVTrue);
+
+  if ((pipeline->sidecar_fp = fopen (name, "wb")) == NULL)
+    {
+      perror (name);
+      exit (-1);
+    }
+
+  filter_options (pipeline, options);
+
+  fwrite (SIDECAR_MAGIC, 1, 8, pipeline->sidecar_fp);
+  put_uint (pipeline->sidecar_fp, SIDECAR_VERSION, 4);
+  put_uint (pipeline->sidecar_fp, (uint64_t) pipeline->batch->size[pipeline->file_num], 8);
+  put_uint (pipeline->sidecar_fp, (uint64_t) strlen (options), 2);
+  fwrite (options, 1, strlen (options), pipeline->sidecar_fp);
+
+  pipeline->sidecar_pings = 0;
+}
+
+
+
+/*  Write the record number, number of beams, and filter flag bits of one ping (this is also used for the
+    checkpoints).  */
+
+void sidecar_put_flags (FILE *fp, gsfSwathBathyPing *ping, int32_t record)
+{
+  int32_t             i;
+  uint8_t             bits;
+
+
+  put_uint (fp, (uint64_t) record, 4);
+  put_uint (fp, (uint64_t) ping->number_beams, 2);
+
+  bits = 0;
+  for (i = 0 ; i < ping->number_beams ; i++)
+    {
+      if ((ping->beam_flags[i] & NV_GSF_IGNORE_FILTER_EDITED) == NV_GSF_IGNORE_FILTER_EDITED) bits |= 1 << (i % 8);
+
+      if (i % 8 == 7 || i == ping->number_beams - 1)
+        {
+          fputc (bits, fp);
+          bits = 0;
+        }
+    }
+}
+
+
+
+/*  Read the flag bits of one ping written by sidecar_put_flags.  bits must have room for MAX_SIDECAR_BEAMS bits.  */
+
+uint8_t sidecar_get_flags (FILE *fp, int32_t *record, int32_t *beams, uint8_t *bits)
+{
+  uint64_t            value;
+
+
+  if (!get_uint (fp, &value, 4)) return (NVFalse);
+  *record = (int32_t) value;
+
+  if (!get_uint (fp, &value, 2) || value > MAX_SIDECAR_BEAMS) return (NVFalse);
+  *beams = (int32_t) value;
+
+  return (fread (bits, 1, (*beams + 7) / 8, fp) == (size_t) (*beams + 7) / 8);
+}
+
+
+
+/*  Set the filter flags of one ping in the GSF file.  This can be done any number of times.  Returns NVFalse
+    (after saying why) if the ping can't be read or written or doesn't have the same number of beams as the
+    flags.  */
+
+uint8_t sidecar_set_flags (int32_t hnd, char *file, int32_t record, int32_t beams, uint8_t *bits)
+{
+  int32_t             j;
+  uint8_t             ok = NVFalse;
+  gsfDataID           id;
+  gsfRecords          gsf_record;
+
+
+  id.recordID = GSF_RECORD_SWATH_BATHYMETRY_PING;
+  id.record_number = record;
+
+  gsf_lock ();
+
+  if (gsfRead (hnd, GSF_RECORD_SWATH_BATHYMETRY_PING, &id, &gsf_record, NULL, 0) < 0)
+    {
+      gsfPrintError (stderr);
+    }
+  else if (gsf_record.mb_ping.number_beams != beams)
+    {
+      fprintf (stderr, "Record %d of %s doesn't match its flags\n", record, file);
+    }
+  else
+    {
+      for (j = 0 ; j < beams ; j++)
+        {
+          if (bits[j / 8] & (1 << (j % 8))) gsf_record.mb_ping.beam_flags[j] |= NV_GSF_IGNORE_FILTER_EDITED;
+        }
+
+      if (gsfWrite (hnd, &id, &gsf_record) < 0)
+        {
+          gsfPrintError (stderr);
+        }
+      else
+        {
+          ok = NVTrue;
+        }
+    }
+
+  gsf_unlock ();
+
+  return (ok);
+}
+
+
+
+/*  Add the flags of one changed ping.  */
+
+void sidecar_ping (PIPELINE *pipeline, gsfSwathBathyPing *ping, int32_t record)
+{
+  sidecar_put_flags (pipeline->sidecar_fp, ping, record);
+
+  pipeline->sidecar_pings++;
+}
+
+
+
+/*  Finish the sidecar and give it its real name.  */
+
+void sidecar_close (PIPELINE *pipeline)
+{
+  char                tmp[2048], name[2048];
+
+
+  put_uint (pipeline->sidecar_fp, 0, 4);
+  put_uint (pipeline->sidecar_fp, (uint64_t) pipeline->sidecar_pings, 4);
+
+  sidecar_name (pipeline->file, tmp, NVTrue);
+  sidecar_name (pipeline->file, name, NVFalse);
+
+  if (ferror (pipeline->sidecar_fp) || fclose (pipeline->sidecar_fp))
+    {
+      perror (tmp);
+      exit (-1);
+    }
+  pipeline->sidecar_fp = NULL;
+
+
+  /*  Windows won't rename over an existing file.  */
+
+  remove (name);
+
+  if (rename (tmp, name))
+    {
+      perror (name);
+      exit (-1);
+    }
+}
+
+
+
+/*  Read and check the sidecar header and make sure the rest of the file is complete.  Returns the number of pings
+    or -1 if there's a problem (which we've already reported).  options (with room for FILTER_OPTIONS characters)
+    gets the filter options for the history record.  Leaves the file positioned at the first ping.  */
+
+static int32_t sidecar_check (FILE *fp, char *name, double size, char *options)
+{
+  char                magic[8];
+  uint64_t            version, file_size, std, flag, length, record, beams, pings, prev;
+  int32_t             count;
+  uint8_t             ok;
+  long                start;
+
+
+  ok = (fread (magic, 1, 8, fp) == 8 && !memcmp (magic, SIDECAR_MAGIC, 8) && get_uint (fp, &version, 4) &&
+        (version == 1 || version == SIDECAR_VERSION) && get_uint (fp, &file_size, 8));
+
+  if (ok && version == 1)
+    {
+      ok = (get_uint (fp, &std, 4) && get_uint (fp, &flag, 1));
+      if (ok) sprintf (options, "-std %.1f%s", (float) std / 1000.0, flag ? " -d" : "");
+    }
+  else if (ok)
+    {
+      ok = (get_uint (fp, &length, 2) && length < FILTER_OPTIONS && fread (options, 1, length, fp) == length);
+      if (ok) options[length] = 0;
+    }
+
+  if (!ok)
+    {
+      fprintf (stderr, "%s is not a gsf_filter sidecar file\n", name);
+      return (-1);
+    }
+
+  if ((double) file_size != size)
+    {
+      fprintf (stderr, "%s doesn't match its GSF file (it may have already been applied)\n", name);
+      return (-1);
+    }
+
+
+  start = ftell (fp);
+
+  count = 0;
+  prev = 0;
+  while (NVTrue)
+    {
+      if (!get_uint (fp, &record, 4)) break;
+
+      if (!record)
+        {
+          if (get_uint (fp, &pings, 4) && pings == (uint64_t) count && fgetc (fp) == EOF)
+            {
+              fseek (fp, start, SEEK_SET);
+              return (count);
+            }
+          break;
+        }
+
+      if (record <= prev || !get_uint (fp, &beams, 2) || fseek (fp, (long) ((beams + 7) / 8), SEEK_CUR)) break;
+
+      prev = record;
+      count++;
+    }
+
+  fprintf (stderr, "%s is not a complete gsf_filter sidecar file\n", name);
+  return (-1);
+}
+
+
+
+/*  Apply the sidecar of one file of the batch.  Problems with the sidecar are reported and the file is skipped so
+    that the rest of the batch can still be applied.  */
+
+void sidecar_apply (BATCH *batch, int32_t file_num)
+{
+  FILE                *fp;
+  char                *file = batch->file[file_num], name[2048], options[FILTER_OPTIONS];
+  int32_t             hnd, i, pings, record, beams;
+  uint8_t             bits[(MAX_SIDECAR_BEAMS + 7) / 8];
+
+
+  printf ("File : %s\n", file);
+  fflush (stdout);
+
+
+  sidecar_name (file, name, NVFalse);
+
+  pings = -1;
+  if ((fp = fopen (name, "rb")) == NULL)
+    {
+      perror (name);
+    }
+  else
+    {
+      pings = sidecar_check (fp, name, batch->size[file_num], options);
+    }
+
+
+  if (pings >= 0)
+    {
+      gsf_lock ();
+
+      if (gsfOpen (file, GSF_UPDATE_INDEX, &hnd))
+        {
+          gsfPrintError (stderr);
+          exit (-1);
+        }
+
+      gsf_unlock ();
+
+
+      for (i = 0 ; i < pings ; i++)
+        {
+          if (!sidecar_get_flags (fp, &record, &beams, bits))
+            {
+              fprintf (stderr, "Error reading %s\n", name);
+              exit (-1);
+            }
+
+          if (!sidecar_set_flags (hnd, file, record, beams, bits)) break;
+
+
+          if (!(i % 100)) batch_progress (batch, file_num, i * 100 / pings);
+        }
+
+
+      gsf_lock ();
+      gsfClose (hnd);
+      gsf_unlock ();
+
+
+      /*  If we stopped part way through, the flags that were set stay set (they'd be set again by applying it
+          again) but there's no history record so the file still matches the sidecar.  */
+
+      if (i < pings)
+        {
+          fprintf (stderr, "Stopped applying %s to %s at record %d, the rest of the flags weren't set\n", name, file,
+                   record);
+        }
+      else
+        {
+          batch_history (batch, file, options);
+        }
+    }
+
+  if (fp != NULL) fclose (fp);
+
+
+  pthread_mutex_lock (&batch->mutex);
+  batch->done++;
+  pthread_mutex_unlock (&batch->mutex);
+
+  batch_progress (batch, file_num, 100);
+}
+
+
+
+/*  Remove the sidecar of a file once it has been applied.  */
+
+void sidecar_remove (char *file)
+{
+  char                name[2048];
+
+
+  sidecar_name (file, name, NVFalse);
+  remove (name);
+}
@@ -0,0 +1,734 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+#include "gsf_filter.h"
+#include <float.h>
+
+#if defined (__x86_64__) || defined (__i386__)
+  #define SIMD_X86
+  #include <immintrin.h>
+#endif
+
+
+/*  Per cell kernels.  These run over the contiguous depths of one cell.  There is a plain C version and, on x86,
+    SSE4.2, AVX2, and AVX-512 versions that are compiled with the target attribute so we don't need any special
+    compiler flags.  The one to use is picked at run time (simd_select).
+
+    The depths and squared depths of a cell are normally added up one at a time in order, exactly like the
+    original loops (cell_sums_c), whatever instruction set is picked.  Adding them up in a different order can
+    change the last bits of the sums and, for the odd point sitting right on the threshold, the flags.  With
+    --lane_sums the vector versions are used instead.  To make every one of those give exactly the same answer
+    the sums are always accumulated the same way.  Depth k goes into partial sum (lane) k % 8 and the eight
+    lanes are added together in order at the end.  The vector versions just do eight lanes at once (four
+    registers of two for SSE4.2, two of four for AVX2, one of eight for AVX-512).  For cells with eight or fewer
+    points this is exactly the same as adding them up one at a time.  The squares are computed in single
+    precision before they're added, just like the original loops.
+    The threshold test has no sums in it so it's the same in every version anyway.
+
+    Each instruction set has four threshold tests, deep only or two sided, in double or float precision.
+    gsf_filter picks the deep only or two sided one once per call so there's no test of deep inside the loops.
+    The double versions convert every depth to double and compare dep - avg with sigma_filter just like the
+    original loop.  The float versions work out once per cell the float depths where that comparison changes
+    (float_limits) and compare the depths with those.  They give exactly the same flags as the double versions
+    and handle twice as many depths per vector without converting them, which is two to four times faster for
+    cells of 32 to 128 points.  Finding the limits costs more than that saves on cells of only a few points so
+    double is the default.  */
+
+#define LANES           8
+
+
+static void combine_lanes (double *lane, double *lane2, double *sum, double *sum2)
+{
+  int32_t l;
+
+
+  *sum = lane[0];
+  *sum2 = lane2[0];
+
+  for (l = 1 ; l < LANES ; l++)
+    {
+      *sum += lane[l];
+      *sum2 += lane2[l];
+    }
+}
+
+
+
+/*  Finish off the points that didn't fill a whole block of eight, put them in the same lanes the plain C version
+    would, and add the lanes up.  If filtered is not NULL the filtered points are skipped (they add zero).  */
+
+static void finish_sums (const float *dep, const uint8_t *filtered, int32_t k, int32_t count, double *lane,
+                         double *lane2, double *sum, double *sum2)
+{
+  for ( ; k < count ; k++)
+    {
+      if (filtered == NULL || !filtered[k])
+        {
+          lane[k & (LANES - 1)] += dep[k];
+          lane2[k & (LANES - 1)] += dep[k] * dep[k];
+        }
+    }
+
+  combine_lanes (lane, lane2, sum, sum2);
+}
+
+
+
+/*  The next float up (or down) from t.  */
+
+static inline float float_step (float t, int32_t up)
+{
+  union
+  {
+    float             f;
+    int32_t           i;
+  } u;
+
+
+  if (t == 0.0) return (up ? FLT_TRUE_MIN : -FLT_TRUE_MIN);
+
+  u.f = t;
+  u.i += ((t > 0.0) == up) ? 1 : -1;
+
+  return (u.f);
+}
+
+
+
+/*  Find the smallest float hi with (double) hi - avg >= sigma_filter and the largest float lo with
+    avg - (double) lo >= sigma_filter.  As the depth goes up the first test only ever goes from false to true and
+    the second from true to false, so the double test filters a depth exactly when it is >= hi (or, for the two
+    sided test, <= lo).  avg +/- sigma_filter rounded to float is within a step of the limit so the loops are
+    short.  Returns NVFalse if avg or sigma_filter isn't finite (the callers fall back to the double test).  */
+
+static uint8_t float_limits (double avg, double sigma_filter, float *hi, float *lo)
+{
+  float t;
+
+
+  if (!isfinite (avg) || !isfinite (sigma_filter)) return (NVFalse);
+
+  t = (float) (avg + sigma_filter);
+  while ((double) t - avg < sigma_filter) t = float_step (t, NVTrue);
+  while ((double) float_step (t, NVFalse) - avg >= sigma_filter) t = float_step (t, NVFalse);
+  *hi = t;
+
+  t = (float) (avg - sigma_filter);
+  while (avg - (double) t < sigma_filter) t = float_step (t, NVFalse);
+  while (avg - (double) float_step (t, NVTrue) >= sigma_filter) t = float_step (t, NVTrue);
+  *lo = t;
+
+  return (NVTrue);
+}
+
+
+
+/*  Make the deep only (name_deep) and two sided (name_both) versions of threshold test name.  target is the
+    function attribute for the instruction set (empty for plain C).  */
+
+#define SPECIALIZE(target, name) \
+target static int32_t name##_deep (const float *dep, int32_t count, double avg, double sigma_filter, uint8_t *filtered) \
+{ \
+  return (name (dep, count, avg, sigma_filter, NVTrue, filtered)); \
+} \
+target static int32_t name##_both (const float *dep, int32_t count, double avg, double sigma_filter, uint8_t *filtered) \
+{ \
+  return (name (dep, count, avg, sigma_filter, NVFalse, filtered)); \
+}
+
+
+
+/*  Plain C versions.  cell_sums_c is the original sequential sum and cell_sums_lanes_c is the lane order version
+    of it.  */
+
+static void cell_sums_c (const float *dep, const uint8_t *filtered, int32_t count, double *sum, double *sum2)
+{
+  int32_t k;
+  double s = 0.0, s2 = 0.0;
+
+
+  for (k = 0 ; k < count ; k++)
+    {
+      if (filtered == NULL || !filtered[k])
+        {
+          s += dep[k];
+          s2 += dep[k] * dep[k];
+        }
+    }
+
+  *sum = s;
+  *sum2 = s2;
+}
+
+
+
+static void cell_sums_lanes_c (const float *dep, const uint8_t *filtered, int32_t count, double *sum, double *sum2)
+{
+  double lane[LANES] = {0.0}, lane2[LANES] = {0.0};
+
+
+  finish_sums (dep, filtered, 0, count, lane, lane2, sum, sum2);
+}
+
+
+
+/*  The threshold tests are written once for each instruction set with deep as an argument and always inlined into
+    the deep only and two sided versions below (see SPECIALIZE) so the test is never made inside the loops.  */
+
+static inline __attribute__ ((always_inline))
+int32_t cell_test_c (const float *dep, int32_t count, double avg, double sigma_filter, uint8_t deep, uint8_t *filtered)
+{
+  int32_t k, nfiltered = 0;
+  double d;
+
+
+  for (k = 0 ; k < count ; k++)
+    {
+      d = (double) dep[k] - avg;
+
+      if (deep)
+        {
+          filtered[k] = (d >= sigma_filter);
+        }
+      else
+        {
+          filtered[k] = (fabs (d) >= sigma_filter);
+        }
+
+      nfiltered += filtered[k];
+    }
+
+  return (nfiltered);
+}
+
+
+
+/*  Test the depths against the float limits from float_limits.  */
+
+static inline __attribute__ ((always_inline))
+int32_t test_limits (const float *dep, int32_t count, float hi, float lo, uint8_t deep, uint8_t *filtered)
+{
+  int32_t k, nfiltered = 0;
+
+
+  for (k = 0 ; k < count ; k++)
+    {
+      if (deep)
+        {
+          filtered[k] = (dep[k] >= hi);
+        }
+      else
+        {
+          filtered[k] = (dep[k] >= hi) | (dep[k] <= lo);
+        }
+
+      nfiltered += filtered[k];
+    }
+
+  return (nfiltered);
+}
+
+
+
+static inline __attribute__ ((always_inline))
+int32_t cell_test_c_float (const float *dep, int32_t count, double avg, double sigma_filter, uint8_t deep,
+                           uint8_t *filtered)
+{
+  float hi, lo;
+
+
+  if (!float_limits (avg, sigma_filter, &hi, &lo)) return (cell_test_c (dep, count, avg, sigma_filter, deep, filtered));
+
+  return (test_limits (dep, count, hi, lo, deep, filtered));
+}
+
+SPECIALIZE (, cell_test_c)
+SPECIALIZE (, cell_test_c_float)
+
+
+
+#ifdef SIMD_X86
+
+/*  SSE4.2  */
+
+__attribute__ ((target ("sse4.2")))
+static void cell_sums_sse42 (const float *dep, const uint8_t *filtered, int32_t count, double *sum, double *sum2)
+{
+  double lane[LANES], lane2[LANES];
+  __m128d s[4], s2[4];
+  __m128 x0, x1, q0, q1;
+  __m128i f;
+  int32_t k, l;
+
+
+  for (l = 0 ; l < 4 ; l++) s[l] = s2[l] = _mm_setzero_pd ();
+
+  for (k = 0 ; k + LANES <= count ; k += LANES)
+    {
+      x0 = _mm_loadu_ps (&dep[k]);
+      x1 = _mm_loadu_ps (&dep[k + 4]);
+
+
+      /*  Zero out the filtered points.  */
+
+      if (filtered != NULL)
+        {
+          f = _mm_loadl_epi64 ((const __m128i *) &filtered[k]);
+          x0 = _mm_and_ps (x0, _mm_castsi128_ps (_mm_cmpeq_epi32 (_mm_cvtepu8_epi32 (f), _mm_setzero_si128 ())));
+          x1 = _mm_and_ps (x1, _mm_castsi128_ps (_mm_cmpeq_epi32 (_mm_cvtepu8_epi32 (_mm_srli_si128 (f, 4)),
+                                                                  _mm_setzero_si128 ())));
+        }
+
+      q0 = _mm_mul_ps (x0, x0);
+      q1 = _mm_mul_ps (x1, x1);
+
+      s[0] = _mm_add_pd (s[0], _mm_cvtps_pd (x0));
+      s[1] = _mm_add_pd (s[1], _mm_cvtps_pd (_mm_movehl_ps (x0, x0)));
+      s[2] = _mm_add_pd (s[2], _mm_cvtps_pd (x1));
+      s[3] = _mm_add_pd (s[3], _mm_cvtps_pd (_mm_movehl_ps (x1, x1)));
+      s2[0] = _mm_add_pd (s2[0], _mm_cvtps_pd (q0));
+      s2[1] = _mm_add_pd (s2[1], _mm_cvtps_pd (_mm_movehl_ps (q0, q0)));
+      s2[2] = _mm_add_pd (s2[2], _mm_cvtps_pd (q1));
+      s2[3] = _mm_add_pd (s2[3], _mm_cvtps_pd (_mm_movehl_ps (q1, q1)));
+    }
+
+  for (l = 0 ; l < 4 ; l++)
+    {
+      _mm_storeu_pd (&lane[l * 2], s[l]);
+      _mm_storeu_pd (&lane2[l * 2], s2[l]);
+    }
+
+  finish_sums (dep, filtered, k, count, lane, lane2, sum, sum2);
+}
+
+
+
+__attribute__ ((target ("sse4.2")))
+static inline __attribute__ ((always_inline))
+int32_t cell_test_sse42 (const float *dep, int32_t count, double avg, double sigma_filter, uint8_t deep,
+                         uint8_t *filtered)
+{
+  __m128d a, sig, abs_mask, d;
+  int32_t k, bits, nfiltered = 0;
+
+
+  a = _mm_set1_pd (avg);
+  sig = _mm_set1_pd (sigma_filter);
+  abs_mask = _mm_castsi128_pd (_mm_set1_epi64x (0x7fffffffffffffffLL));
+
+  for (k = 0 ; k + 2 <= count ; k += 2)
+    {
+      d = _mm_sub_pd (_mm_cvtps_pd (_mm_castsi128_ps (_mm_loadl_epi64 ((const __m128i *) &dep[k]))), a);
+      if (!deep) d = _mm_and_pd (d, abs_mask);
+
+      bits = _mm_movemask_pd (_mm_cmpge_pd (d, sig));
+
+      filtered[k] = bits & 1;
+      filtered[k + 1] = (bits >> 1) & 1;
+      nfiltered += filtered[k] + filtered[k + 1];
+    }
+
+  return (nfiltered + cell_test_c (&dep[k], count - k, avg, sigma_filter, deep, &filtered[k]));
+}
+
+
+__attribute__ ((target ("sse4.2")))
+static inline __attribute__ ((always_inline))
+int32_t cell_test_sse42_float (const float *dep, int32_t count, double avg, double sigma_filter, uint8_t deep,
+                               uint8_t *filtered)
+{
+  __m128 h, l, x0, x1, m0, m1;
+  __m128i b;
+  int32_t k, nfiltered = 0;
+  float hi, lo;
+
+
+  if (!float_limits (avg, sigma_filter, &hi, &lo))
+    return (cell_test_sse42 (dep, count, avg, sigma_filter, deep, filtered));
+
+  h = _mm_set1_ps (hi);
+  l = _mm_set1_ps (lo);
+
+  for (k = 0 ; k + LANES <= count ; k += LANES)
+    {
+      x0 = _mm_loadu_ps (&dep[k]);
+      x1 = _mm_loadu_ps (&dep[k + 4]);
+
+      m0 = _mm_cmpge_ps (x0, h);
+      m1 = _mm_cmpge_ps (x1, h);
+
+      if (!deep)
+        {
+          m0 = _mm_or_ps (m0, _mm_cmple_ps (x0, l));
+          m1 = _mm_or_ps (m1, _mm_cmple_ps (x1, l));
+        }
+
+
+      /*  Pack the lane masks down to a byte per depth and store them as 0 or 1.  */
+
+      b = _mm_packs_epi32 (_mm_castps_si128 (m0), _mm_castps_si128 (m1));
+      _mm_storel_epi64 ((__m128i *) &filtered[k], _mm_and_si128 (_mm_packs_epi16 (b, b), _mm_set1_epi8 (1)));
+
+      nfiltered += __builtin_popcount (_mm_movemask_ps (m0) | (_mm_movemask_ps (m1) << 4));
+    }
+
+  return (nfiltered + test_limits (&dep[k], count - k, hi, lo, deep, &filtered[k]));
+}
+
+SPECIALIZE (__attribute__ ((target ("sse4.2"))), cell_test_sse42)
+SPECIALIZE (__attribute__ ((target ("sse4.2"))), cell_test_sse42_float)
+
+
+
+
+/*  AVX2  */
+
+__attribute__ ((target ("avx2")))
+static void cell_sums_avx2 (const float *dep, const uint8_t *filtered, int32_t count, double *sum, double *sum2)
+{
+  double lane[LANES], lane2[LANES];
+  __m256d s_lo, s_hi, s2_lo, s2_hi;
+  __m256 x, q;
+  int32_t k;
+
+
+  s_lo = s_hi = s2_lo = s2_hi = _mm256_setzero_pd ();
+
+  for (k = 0 ; k + LANES <= count ; k += LANES)
+    {
+      x = _mm256_loadu_ps (&dep[k]);
+
+      if (filtered != NULL)
+        {
+          x = _mm256_and_ps (x, _mm256_castsi256_ps (_mm256_cmpeq_epi32 (_mm256_cvtepu8_epi32 (_mm_loadl_epi64 ((const __m128i *) &filtered[k])),
+                                                                         _mm256_setzero_si256 ())));
+        }
+
+      q = _mm256_mul_ps (x, x);
+
+      s_lo = _mm256_add_pd (s_lo, _mm256_cvtps_pd (_mm256_castps256_ps128 (x)));
+      s_hi = _mm256_add_pd (s_hi, _mm256_cvtps_pd (_mm256_extractf128_ps (x, 1)));
+      s2_lo = _mm256_add_pd (s2_lo, _mm256_cvtps_pd (_mm256_castps256_ps128 (q)));
+      s2_hi = _mm256_add_pd (s2_hi, _mm256_cvtps_pd (_mm256_extractf128_ps (q, 1)));
+    }
+
+  _mm256_storeu_pd (&lane[0], s_lo);
+  _mm256_storeu_pd (&lane[4], s_hi);
+  _mm256_storeu_pd (&lane2[0], s2_lo);
+  _mm256_storeu_pd (&lane2[4], s2_hi);
+
+  finish_sums (dep, filtered, k, count, lane, lane2, sum, sum2);
+}
+
+
+
+__attribute__ ((target ("avx2")))
+static inline __attribute__ ((always_inline))
+int32_t cell_test_avx2 (const float *dep, int32_t count, double avg, double sigma_filter, uint8_t deep,
+                        uint8_t *filtered)
+{
+  __m256d a, sig, abs_mask, d;
+  int32_t k, l, bits, nfiltered = 0;
+
+
+  a = _mm256_set1_pd (avg);
+  sig = _mm256_set1_pd (sigma_filter);
+  abs_mask = _mm256_castsi256_pd (_mm256_set1_epi64x (0x7fffffffffffffffLL));
+
+  for (k = 0 ; k + 4 <= count ; k += 4)
+    {
+      d = _mm256_sub_pd (_mm256_cvtps_pd (_mm_loadu_ps (&dep[k])), a);
+      if (!deep) d = _mm256_and_pd (d, abs_mask);
+
+      bits = _mm256_movemask_pd (_mm256_cmp_pd (d, sig, _CMP_GE_OQ));
+
+      for (l = 0 ; l < 4 ; l++)
+        {
+          filtered[k + l] = (bits >> l) & 1;
+          nfiltered += filtered[k + l];
+        }
+    }
+
+  return (nfiltered + cell_test_c (&dep[k], count - k, avg, sigma_filter, deep, &filtered[k]));
+}
+
+
+__attribute__ ((target ("avx2")))
+static inline __attribute__ ((always_inline))
+int32_t cell_test_avx2_float (const float *dep, int32_t count, double avg, double sigma_filter, uint8_t deep,
+                              uint8_t *filtered)
+{
+  __m256 h, l, x, m;
+  __m128i b;
+  int32_t k, nfiltered = 0;
+  float hi, lo;
+
+
+  if (!float_limits (avg, sigma_filter, &hi, &lo))
+    return (cell_test_avx2 (dep, count, avg, sigma_filter, deep, filtered));
+
+  h = _mm256_set1_ps (hi);
+  l = _mm256_set1_ps (lo);
+
+  for (k = 0 ; k + LANES <= count ; k += LANES)
+    {
+      x = _mm256_loadu_ps (&dep[k]);
+
+      m = _mm256_cmp_ps (x, h, _CMP_GE_OQ);
+      if (!deep) m = _mm256_or_ps (m, _mm256_cmp_ps (x, l, _CMP_LE_OQ));
+
+      b = _mm_packs_epi32 (_mm256_castsi256_si128 (_mm256_castps_si256 (m)),
+                           _mm256_extractf128_si256 (_mm256_castps_si256 (m), 1));
+      _mm_storel_epi64 ((__m128i *) &filtered[k], _mm_and_si128 (_mm_packs_epi16 (b, b), _mm_set1_epi8 (1)));
+
+      nfiltered += __builtin_popcount (_mm256_movemask_ps (m));
+    }
+
+  return (nfiltered + test_limits (&dep[k], count - k, hi, lo, deep, &filtered[k]));
+}
+
+SPECIALIZE (__attribute__ ((target ("avx2"))), cell_test_avx2)
+SPECIALIZE (__attribute__ ((target ("avx2"))), cell_test_avx2_float)
+
+
+
+
+/*  AVX-512  */
+
+__attribute__ ((target ("avx512f")))
+static void cell_sums_avx512 (const float *dep, const uint8_t *filtered, int32_t count, double *sum, double *sum2)
+{
+  double lane[LANES], lane2[LANES];
+  __m512d s, s2, x;
+  __m256 xf;
+  __mmask8 keep;
+  int32_t k;
+
+
+  s = s2 = _mm512_setzero_pd ();
+  keep = 0xff;
+
+  for (k = 0 ; k + LANES <= count ; k += LANES)
+    {
+      xf = _mm256_loadu_ps (&dep[k]);
+      x = _mm512_cvtps_pd (xf);
+
+
+      /*  Only add the lanes for points that aren't filtered (the others stay as they are, which is the same as
+          adding zero).  */
+
+      if (filtered != NULL)
+        {
+          keep = (__mmask8) _mm_movemask_epi8 (_mm_cmpeq_epi8 (_mm_loadl_epi64 ((const __m128i *) &filtered[k]),
+                                                               _mm_setzero_si128 ()));
+        }
+
+      s = _mm512_mask_add_pd (s, keep, s, x);
+      s2 = _mm512_mask_add_pd (s2, keep, s2, _mm512_cvtps_pd (_mm256_mul_ps (xf, xf)));
+    }
+
+  _mm512_storeu_pd (lane, s);
+  _mm512_storeu_pd (lane2, s2);
+
+  finish_sums (dep, filtered, k, count, lane, lane2, sum, sum2);
+}
+
+
+
+__attribute__ ((target ("avx512f")))
+static inline __attribute__ ((always_inline))
+int32_t cell_test_avx512 (const float *dep, int32_t count, double avg, double sigma_filter, uint8_t deep,
+                          uint8_t *filtered)
+{
+  __m512d a, sig, d;
+  __mmask8 bits;
+  int32_t k, l, nfiltered = 0;
+
+
+  a = _mm512_set1_pd (avg);
+  sig = _mm512_set1_pd (sigma_filter);
+
+  for (k = 0 ; k + LANES <= count ; k += LANES)
+    {
+      d = _mm512_sub_pd (_mm512_cvtps_pd (_mm256_loadu_ps (&dep[k])), a);
+      if (!deep) d = _mm512_abs_pd (d);
+
+      bits = _mm512_cmp_pd_mask (d, sig, _CMP_GE_OQ);
+
+      for (l = 0 ; l < LANES ; l++)
+        {
+          filtered[k + l] = (bits >> l) & 1;
+          nfiltered += filtered[k + l];
+        }
+    }
+
+  return (nfiltered + cell_test_c (&dep[k], count - k, avg, sigma_filter, deep, &filtered[k]));
+}
+
+
+/*  AVX-512 does sixteen float depths at a time.  */
+
+__attribute__ ((target ("avx512f")))
+static inline __attribute__ ((always_inline))
+int32_t cell_test_avx512_float (const float *dep, int32_t count, double avg, double sigma_filter, uint8_t deep,
+                                uint8_t *filtered)
+{
+  __m512 h, l, x;
+  __mmask16 m;
+  int32_t k, nfiltered = 0;
+  float hi, lo;
+
+
+  if (!float_limits (avg, sigma_filter, &hi, &lo))
+    return (cell_test_avx512 (dep, count, avg, sigma_filter, deep, filtered));
+
+  h = _mm512_set1_ps (hi);
+  l = _mm512_set1_ps (lo);
+
+  for (k = 0 ; k + 16 <= count ; k += 16)
+    {
+      x = _mm512_loadu_ps (&dep[k]);
+
+      m = _mm512_cmp_ps_mask (x, h, _CMP_GE_OQ);
+      if (!deep) m |= _mm512_cmp_ps_mask (x, l, _CMP_LE_OQ);
+
+      _mm_storeu_si128 ((__m128i *) &filtered[k], _mm512_cvtepi32_epi8 (_mm512_maskz_set1_epi32 (m, 1)));
+
+      nfiltered += __builtin_popcount (m);
+    }
+
+  return (nfiltered + test_limits (&dep[k], count - k, hi, lo, deep, &filtered[k]));
+}
+
+SPECIALIZE (__attribute__ ((target ("avx512f"))), cell_test_avx512)
+SPECIALIZE (__attribute__ ((target ("avx512f"))), cell_test_avx512_float)
+
+
+#endif
+
+
+
+/*  The kernels for each instruction set.  sums are the lane order sums (only used with --lane_sums).  test is
+    indexed by [float][deep].  */
+
+typedef struct
+{
+  const char          *isa;
+  CELL_SUMS           sums;
+  CELL_TEST           test[2][2];
+} KERNELS;
+
+static const KERNELS kernels[] =
+  {
+    {"scalar", cell_sums_lanes_c, {{cell_test_c_both, cell_test_c_deep}, {cell_test_c_float_both, cell_test_c_float_deep}}},
+#ifdef SIMD_X86
+    {"sse4.2", cell_sums_sse42, {{cell_test_sse42_both, cell_test_sse42_deep},
+                                 {cell_test_sse42_float_both, cell_test_sse42_float_deep}}},
+    {"avx2", cell_sums_avx2, {{cell_test_avx2_both, cell_test_avx2_deep},
+                              {cell_test_avx2_float_both, cell_test_avx2_float_deep}}},
+    {"avx512", cell_sums_avx512, {{cell_test_avx512_both, cell_test_avx512_deep},
+                                  {cell_test_avx512_float_both, cell_test_avx512_float_deep}}},
+#endif
+  };
+
+
+
+/*  The kernels in use.  These start out as the plain C versions.  cell_test is indexed by deep.  */
+
+CELL_SUMS cell_sums = cell_sums_c;
+CELL_TEST cell_test[2] = {cell_test_c_both, cell_test_c_deep};
+static uint8_t simd_lanes = NVFalse;
+static char simd_label[64] = "scalar, double";
+
+
+
+/*  Pick the kernels.  isa is "auto" (the best that the processor supports), "scalar", "sse4.2", "avx2", or
+    "avx512".  precision is "double" or "float" (see the threshold tests above, they give the same answer).  If
+    lane_sums is set the sums are added up in lane order by the vector versions, otherwise they're the original
+    sequential sums.  Returns NVFalse if the processor (or this build) doesn't support the instruction set asked
+    for or the precision isn't one of those.  */
+
+uint8_t simd_select (const char *isa, const char *precision, uint8_t lane_sums)
+{
+  int32_t i, use = -1;
+  uint8_t want_auto = !strcmp (isa, "auto"), single;
+
+
+  if (!strcmp (precision, "float"))
+    {
+      single = NVTrue;
+    }
+  else if (!strcmp (precision, "double"))
+    {
+      single = NVFalse;
+    }
+  else
+    {
+      return (NVFalse);
+    }
+
+
+  if (!strcmp (isa, "scalar")) use = 0;
+
+
+#ifdef SIMD_X86
+
+  __builtin_cpu_init ();
+
+  if (use < 0 && (want_auto || !strcmp (isa, "avx512")) && __builtin_cpu_supports ("avx512f")) use = 3;
+
+  if (use < 0 && (want_auto || !strcmp (isa, "avx2")) && __builtin_cpu_supports ("avx2")) use = 2;
+
+  if (use < 0 && (want_auto || !strcmp (isa, "sse4.2")) && __builtin_cpu_supports ("sse4.2")) use = 1;
+
+#endif
+
+
+  if (use < 0 && want_auto) use = 0;
+
+  if (use < 0) return (NVFalse);
+
+
+  cell_sums = lane_sums ? kernels[use].sums : cell_sums_c;
+  for (i = 0 ; i < 2 ; i++) cell_test[i] = kernels[use].test[single][i];
+  simd_lanes = lane_sums;
+  sprintf (simd_label, "%s, %s%s", kernels[use].isa, precision, lane_sums ? ", lane sums" : "");
+
+  return (NVTrue);
+}
+
+
+
+/*  Whether the lane order sums are in use (they're part of the options that have to match on --resume).  */
+
+uint8_t simd_lane_sums ()
+{
+  return (simd_lanes);
+}
+
+
+
+const char *simd_name ()
+{
+  return (simd_label);
+}
@@ -0,0 +1,1112 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+#include "gsf_filter.h"
+
+#ifdef NVWIN3X
+    #include <process.h>
+    #define getpid _getpid
+    #define fseeko _fseeki64
+#else
+    #include <unistd.h>
+#endif
+
+
+/*  Survey mode (--survey).
+
+    Normally each file is filtered on its own, a page of pings at a time, so overlapping lines never see each
+    other's soundings.  In survey mode all of the files are filtered together on a grid of square tiles fixed to
+    the earth (tile_size meters of latitude on a side, in degrees in both directions like the page grids).  This
+    is done in three passes:
+
+        1.  Read every file with read_page, georeference the beams with page_points, and add each sounding, with
+            its file, record, and beam numbers, to its tile.
+        2.  Go through the tiles in row and column order.  Each tile is gridded and filtered with the soundings
+            of its neighbors that are within a couple of cells of its edges (like the page halo), and the tile's
+            own soundings that were filtered are marked and added to the flag list of the file they came from.
+            Just like the page halo, the neighbors' soundings that were flagged when their own tile was filtered
+            are left out.
+        3.  Sort each file's flags by record and write them to the file's sidecar (see sidecar.c).  Unless
+            --sidecar was given the sidecar is then applied to the GSF file and removed.  Going through the
+            sidecar means that if the run is stopped while the flags are being set it can be finished with
+            --apply.
+
+    A survey can have far more soundings than will fit in memory so the tiles are kept in a cache (TILE_CACHE)
+    with a memory budget (--memory, DEFAULT_TILE_CACHE megabytes if that isn't set).  When the soundings in memory
+    go over the budget the least recently used tiles are appended to a spill file in --tile_dir and read back
+    when pass 2 needs them.  Since pass 2 works across the tiles in rows only the last couple of rows are needed
+    at any one time.  The flag lists (FLAG_CACHE) get 1 / FLAG_SHARE of the budget.  When they go over it they're
+    sorted and appended to a second spill file as runs, and pass 3 merges each file's runs back together.  Only
+    the grid of the tile being filtered and the merge buffers of pass 3 come on top of the budget.  */
+
+#define DEFAULT_TILE_CACHE    1024.0
+#define MIN_TILE_CACHE        16.0
+#define TILE_CHUNK            4096                  /*  Soundings in a tile's first buffer  */
+#define FLAG_SHARE            4
+#define FLAG_BUFFER           4096                  /*  Flags read at a time from each run in pass 3  */
+
+
+/*  For sorting the tiles.  */
+
+typedef struct
+{
+  int32_t             row;
+  int32_t             col;
+  int32_t             tile;
+} TILE_KEY;
+
+
+/*  One sorted run of flags being merged in pass 3.  flag holds count flags (next is the next one), the other left
+    are still in the spill file at offset.  */
+
+typedef struct
+{
+  SURVEY_FLAG         *flag;
+  int32_t             count;
+  int32_t             next;
+  int64_t             offset;
+  int32_t             left;
+} FLAG_RUN;
+
+
+
+static int32_t tile_hash (int32_t row, int32_t col, int32_t mask)
+{
+  return ((int32_t) (((uint32_t) row * 73856093u) ^ ((uint32_t) col * 19349663u)) & mask);
+}
+
+
+
+static void table_grow (TILE_CACHE *cache)
+{
+  int32_t             i, k, mask;
+
+
+  cache->table_size = cache->table_size ? cache->table_size * 2 : 1024;
+  mask = cache->table_size - 1;
+
+  free (cache->table);
+  cache->table = (int32_t *) malloc (cache->table_size * sizeof (int32_t));
+  if (cache->table == NULL)
+    {
+      perror ("Allocating tile table memory");
+      exit (-1);
+    }
+
+  for (i = 0 ; i < cache->table_size ; i++) cache->table[i] = -1;
+
+  for (i = 0 ; i < cache->tiles ; i++)
+    {
+      k = tile_hash (cache->tile[i].row, cache->tile[i].col, mask);
+      while (cache->table[k] >= 0) k = (k + 1) & mask;
+      cache->table[k] = i;
+    }
+}
+
+
+
+/*  Find the tile at row, col.  If it isn't there we add it if create is set and return -1 if it isn't.  */
+
+static int32_t tile_find (TILE_CACHE *cache, int32_t row, int32_t col, uint8_t create)
+{
+  int32_t             k, t, mask;
+  TILE                *tile;
+
+
+  if (create && (cache->tiles + 1) * 2 > cache->table_size) table_grow (cache);
+  if (!cache->table_size) return (-1);
+
+  mask = cache->table_size - 1;
+
+  for (k = tile_hash (row, col, mask) ; cache->table[k] >= 0 ; k = (k + 1) & mask)
+    {
+      t = cache->table[k];
+      if (cache->tile[t].row == row && cache->tile[t].col == col) return (t);
+    }
+
+  if (!create) return (-1);
+
+
+  if (cache->tiles == cache->tile_size)
+    {
+      cache->tile_size = cache->tile_size ? cache->tile_size * 2 : 256;
+      cache->tile = (TILE *) realloc (cache->tile, cache->tile_size * sizeof (TILE));
+      if (cache->tile == NULL)
+        {
+          perror ("Allocating tile memory");
+          exit (-1);
+        }
+    }
+
+  t = cache->tiles++;
+  tile = &cache->tile[t];
+  memset (tile, 0, sizeof (TILE));
+  tile->row = row;
+  tile->col = col;
+  tile->prev = tile->next = -1;
+
+  cache->table[k] = t;
+
+  return (t);
+}
+
+
+
+/*  Least recently used list.  */
+
+static void lru_unlink (TILE_CACHE *cache, int32_t t)
+{
+  TILE                *tile = &cache->tile[t];
+
+
+  if (tile->prev >= 0)
+    {
+      cache->tile[tile->prev].next = tile->next;
+    }
+  else
+    {
+      cache->lru_head = tile->next;
+    }
+
+  if (tile->next >= 0)
+    {
+      cache->tile[tile->next].prev = tile->prev;
+    }
+  else
+    {
+      cache->lru_tail = tile->prev;
+    }
+
+  tile->prev = tile->next = -1;
+}
+
+
+
+static void lru_push (TILE_CACHE *cache, int32_t t)
+{
+  TILE                *tile = &cache->tile[t];
+
+
+  tile->prev = -1;
+  tile->next = cache->lru_head;
+
+  if (cache->lru_head >= 0)
+    {
+      cache->tile[cache->lru_head].prev = t;
+    }
+  else
+    {
+      cache->lru_tail = t;
+    }
+
+  cache->lru_head = t;
+}
+
+
+
+/*  Write the soundings of a tile that aren't in the spill file yet to the end of it and drop the tile's data.  */
+
+static void tile_spill (TILE_CACHE *cache, int32_t t)
+{
+  TILE                *tile = &cache->tile[t];
+  int32_t             i, n, skip, count;
+
+
+  /*  A tile is only filtered when all of it is in memory (first is 0) so its data starts with the first chunk.
+      If it was filtered since it was loaded the filtered marks of the spilled soundings have changed, so the
+      chunks are written again in place.  */
+
+  if (tile->dirty)
+    {
+      n = 0;
+      for (i = 0 ; i < tile->chunks ; i++)
+        {
+          if (fseeko (cache->spill_fp, tile->chunk_offset[i], SEEK_SET) ||
+              fwrite (&tile->data[n], sizeof (SOUNDING), tile->chunk_count[i], cache->spill_fp) !=
+              (size_t) tile->chunk_count[i])
+            {
+              perror (cache->spill_name);
+              exit (-1);
+            }
+          n += tile->chunk_count[i];
+        }
+
+      tile->dirty = NVFalse;
+    }
+
+
+  skip = tile->on_disk - tile->first;
+  count = tile->used - skip;
+
+  if (count > 0)
+    {
+      if (cache->spill_fp == NULL && (cache->spill_fp = fopen (cache->spill_name, "w+b")) == NULL)
+        {
+          perror (cache->spill_name);
+          exit (-1);
+        }
+
+      if (fseeko (cache->spill_fp, cache->spill_end, SEEK_SET) ||
+          fwrite (&tile->data[skip], sizeof (SOUNDING), count, cache->spill_fp) != (size_t) count)
+        {
+          perror (cache->spill_name);
+          exit (-1);
+        }
+
+      tile->chunk_offset = (int64_t *) realloc (tile->chunk_offset, (tile->chunks + 1) * sizeof (int64_t));
+      tile->chunk_count = (int32_t *) realloc (tile->chunk_count, (tile->chunks + 1) * sizeof (int32_t));
+      if (tile->chunk_offset == NULL || tile->chunk_count == NULL)
+        {
+          perror ("Allocating tile chunk memory");
+          exit (-1);
+        }
+
+      tile->chunk_offset[tile->chunks] = cache->spill_end;
+      tile->chunk_count[tile->chunks] = count;
+      tile->chunks++;
+      tile->on_disk += count;
+
+      cache->spill_end += (int64_t) count * sizeof (SOUNDING);
+      cache->spilled += count;
+    }
+
+  cache->memory -= (double) tile->size * sizeof (SOUNDING);
+
+  free (tile->data);
+  tile->data = NULL;
+  tile->first = tile->on_disk;
+  tile->used = tile->size = 0;
+
+  lru_unlink (cache, t);
+}
+
+
+
+/*  Spill the least recently used tiles that aren't pinned until we're back under the budget.  */
+
+static void cache_trim (TILE_CACHE *cache)
+{
+  int32_t             t;
+
+
+  t = cache->lru_tail;
+
+  while (cache->memory > cache->budget && t >= 0)
+    {
+      if (cache->tile[t].pinned)
+        {
+          t = cache->tile[t].prev;
+        }
+      else
+        {
+          tile_spill (cache, t);
+          t = cache->lru_tail;
+        }
+    }
+}
+
+
+
+/*  Add a sounding to its tile.  */
+
+static void tile_add (TILE_CACHE *cache, SOUNDING *sounding)
+{
+  int32_t             t, size;
+  TILE                *tile;
+
+
+  t = tile_find (cache, (int32_t) floor (sounding->lat / cache->tile_deg),
+                 (int32_t) floor (sounding->lon / cache->tile_deg), NVTrue);
+  tile = &cache->tile[t];
+
+  if (tile->data == NULL)
+    {
+      lru_push (cache, t);
+    }
+  else if (cache->lru_head != t)
+    {
+      lru_unlink (cache, t);
+      lru_push (cache, t);
+    }
+
+  if (tile->used == tile->size)
+    {
+      size = tile->size ? tile->size * 2 : TILE_CHUNK;
+      tile->data = (SOUNDING *) realloc (tile->data, size * sizeof (SOUNDING));
+      if (tile->data == NULL)
+        {
+          perror ("Allocating tile memory");
+          exit (-1);
+        }
+
+      cache->memory += (double) (size - tile->size) * sizeof (SOUNDING);
+      tile->size = size;
+    }
+
+  tile->data[tile->used++] = *sounding;
+  tile->count++;
+
+
+  if (cache->memory > cache->budget)
+    {
+      tile->pinned = NVTrue;
+      cache_trim (cache);
+      tile->pinned = NVFalse;
+    }
+}
+
+
+
+/*  Get all of a tile's soundings into memory.  The spill file chunks are kept so that if the tile is spilled again
+    we don't have to write it again.  */
+
+static void tile_load (TILE_CACHE *cache, int32_t t)
+{
+  TILE                *tile = &cache->tile[t];
+  SOUNDING            *data;
+  int32_t             i, n;
+
+
+  if (tile->data != NULL) lru_unlink (cache, t);
+
+
+  if (tile->first)
+    {
+      data = (SOUNDING *) malloc (tile->count * sizeof (SOUNDING));
+      if (data == NULL)
+        {
+          perror ("Allocating tile memory");
+          exit (-1);
+        }
+
+      n = 0;
+      for (i = 0 ; i < tile->chunks ; i++)
+        {
+          if (fseeko (cache->spill_fp, tile->chunk_offset[i], SEEK_SET) ||
+              fread (&data[n], sizeof (SOUNDING), tile->chunk_count[i], cache->spill_fp) !=
+              (size_t) tile->chunk_count[i])
+            {
+              perror (cache->spill_name);
+              exit (-1);
+            }
+          n += tile->chunk_count[i];
+        }
+
+      if (tile->used) memcpy (&data[n], tile->data, tile->used * sizeof (SOUNDING));
+
+      cache->memory += (double) (tile->count - tile->size) * sizeof (SOUNDING);
+      cache->reloaded += tile->on_disk;
+
+      free (tile->data);
+      tile->data = data;
+      tile->first = 0;
+      tile->used = tile->size = tile->count;
+    }
+
+  lru_push (cache, t);
+
+  cache_trim (cache);
+}
+
+
+
+static void cache_free (TILE_CACHE *cache)
+{
+  int32_t             i;
+
+
+  for (i = 0 ; i < cache->tiles ; i++)
+    {
+      free (cache->tile[i].data);
+      free (cache->tile[i].chunk_offset);
+      free (cache->tile[i].chunk_count);
+    }
+
+  free (cache->tile);
+  free (cache->table);
+
+  if (cache->spill_fp != NULL)
+    {
+      fclose (cache->spill_fp);
+      remove (cache->spill_name);
+    }
+}
+
+
+
+/*  Pass 1, read all of the files into the tiles.  */
+
+static void survey_read (BATCH *batch, TILE_CACHE *cache, PIPELINE *pipeline, PAGE *page)
+{
+  int32_t             i, j, count, file_num;
+  char                *file;
+  uint8_t             mapped;
+  SOUNDING            sounding;
+  POINT_BUF           *points = &pipeline->points;
+
+
+  for (file_num = 0 ; file_num < batch->files ; file_num++)
+    {
+      file = batch->file[file_num];
+
+      printf ("File : %s\n", file);
+      fflush (stdout);
+
+
+      pipeline->file = file;
+      pipeline->file_num = file_num;
+      pipeline->start_rec = 1;
+      pipeline->prev_lat = -999.0;
+      pipeline->prev_lon = -999.0;
+      pipeline->read_hnd = -1;
+
+      mapped = pipeline->fast_read && gsf_map_open (&pipeline->map, file);
+
+      if (!mapped || pipeline->fast_read_check)
+        {
+          gsf_lock ();
+
+          if (gsfOpen (file, GSF_READONLY_INDEX, &pipeline->read_hnd))
+            {
+              gsfPrintError (stderr);
+              exit (-1);
+            }
+
+          gsf_unlock ();
+        }
+
+
+      do
+        {
+          read_page (pipeline, page);
+
+          count = page_points (pipeline, page);
+
+          for (i = 0 ; i < count ; i++)
+            {
+              j = points->ping[i] - page->page_start;
+
+              sounding.lat = points->lat[i];
+              sounding.lon = points->lon[i];
+              sounding.dep = points->dep[i];
+              sounding.file = file_num;
+              sounding.ping = points->ping[i];
+              sounding.beam = (uint16_t) points->beam[i];
+              sounding.beams = (uint16_t) MIN (page->ping_rec[j].mb_ping.number_beams, MAX_SIDECAR_BEAMS);
+              sounding.filtered = NVFalse;
+
+              tile_add (cache, &sounding);
+            }
+
+          batch_progress (batch, file_num, page->percent);
+        } while (!page->last);
+
+
+      gsf_map_close (&pipeline->map);
+
+      if (pipeline->read_hnd >= 0)
+        {
+          gsf_lock ();
+          gsfClose (pipeline->read_hnd);
+          gsf_unlock ();
+        }
+
+      pthread_mutex_lock (&batch->mutex);
+      batch->done++;
+      pthread_mutex_unlock (&batch->mutex);
+
+      batch_progress (batch, file_num, 100);
+    }
+}
+
+
+
+static int32_t compare_tiles (const void *a, const void *b)
+{
+  const TILE_KEY *ka = (const TILE_KEY *) a, *kb = (const TILE_KEY *) b;
+
+
+  if (ka->row != kb->row) return (ka->row < kb->row ? -1 : 1);
+  if (ka->col != kb->col) return (ka->col < kb->col ? -1 : 1);
+  return (0);
+}
+
+
+
+/*  Add the tile's soundings that are within margin degrees of the lat0, lon0 to lat1, lon1 box, and weren't
+    flagged with their own tile, to the point buffer (all of them if margin is negative).  Returns the new point
+    count.  */
+
+static int32_t tile_points (TILE *tile, POINT_BUF *points, int32_t count, double lat0, double lon0, double lat1,
+                            double lon1, double margin, NV_F64_XYMBR *mbr, double *sum_z)
+{
+  int32_t             i;
+  SOUNDING            *s;
+
+
+  for (i = 0 ; i < tile->count ; i++)
+    {
+      s = &tile->data[i];
+
+      if (margin >= 0.0 && (s->filtered || s->lat < lat0 - margin || s->lat >= lat1 + margin ||
+                            s->lon < lon0 - margin || s->lon >= lon1 + margin)) continue;
+
+      if (count == points->size) point_buf_grow (points, count + 1);
+
+      points->lat[count] = s->lat;
+      points->lon[count] = s->lon;
+      points->dep[count] = s->dep;
+      points->ping[count] = s->ping;
+      points->beam[count] = (int16_t) s->beam;
+
+      mbr->min_y = MIN (mbr->min_y, s->lat);
+      mbr->max_y = MAX (mbr->max_y, s->lat);
+      mbr->min_x = MIN (mbr->min_x, s->lon);
+      mbr->max_x = MAX (mbr->max_x, s->lon);
+      *sum_z += s->dep;
+
+      count++;
+    }
+
+  return (count);
+}
+
+
+
+static int32_t compare_flags (const void *a, const void *b)
+{
+  const SURVEY_FLAG *fa = (const SURVEY_FLAG *) a, *fb = (const SURVEY_FLAG *) b;
+
+
+  if (fa->ping != fb->ping) return (fa->ping < fb->ping ? -1 : 1);
+  if (fa->beam != fb->beam) return (fa->beam < fb->beam ? -1 : 1);
+  return (0);
+}
+
+
+
+/*  Sort every file's flags and append them to the flag spill file as a run, then drop them from memory.  */
+
+static void flags_spill (FLAG_CACHE *flags, int32_t files)
+{
+  int32_t             f;
+  SURVEY_FLAGS        *list;
+
+
+  for (f = 0 ; f < files ; f++)
+    {
+      list = &flags->file[f];
+
+      if (list->count)
+        {
+          if (flags->spill_fp == NULL && (flags->spill_fp = fopen (flags->spill_name, "w+b")) == NULL)
+            {
+              perror (flags->spill_name);
+              exit (-1);
+            }
+
+          qsort (list->flag, list->count, sizeof (SURVEY_FLAG), compare_flags);
+
+          if (fseeko (flags->spill_fp, flags->spill_end, SEEK_SET) ||
+              fwrite (list->flag, sizeof (SURVEY_FLAG), list->count, flags->spill_fp) != (size_t) list->count)
+            {
+              perror (flags->spill_name);
+              exit (-1);
+            }
+
+          list->run_offset = (int64_t *) realloc (list->run_offset, (list->runs + 1) * sizeof (int64_t));
+          list->run_count = (int32_t *) realloc (list->run_count, (list->runs + 1) * sizeof (int32_t));
+          if (list->run_offset == NULL || list->run_count == NULL)
+            {
+              perror ("Allocating flag run memory");
+              exit (-1);
+            }
+
+          list->run_offset[list->runs] = flags->spill_end;
+          list->run_count[list->runs] = list->count;
+          list->runs++;
+
+          flags->spill_end += (int64_t) list->count * sizeof (SURVEY_FLAG);
+          flags->spilled += list->count;
+        }
+
+      free (list->flag);
+      list->flag = NULL;
+      list->count = list->size = 0;
+    }
+
+  flags->memory = 0.0;
+}
+
+
+
+/*  Add a flagged sounding to the flag list of its file, spilling all of the lists if they're over budget.  */
+
+static void flag_add (FLAG_CACHE *flags, int32_t files, SOUNDING *s)
+{
+  SURVEY_FLAGS        *list = &flags->file[s->file];
+
+
+  if (list->count == list->size)
+    {
+      list->size = list->size ? list->size * 2 : 1024;
+      list->flag = (SURVEY_FLAG *) realloc (list->flag, list->size * sizeof (SURVEY_FLAG));
+      if (list->flag == NULL)
+        {
+          perror ("Allocating flag memory");
+          exit (-1);
+        }
+
+      flags->memory += (double) (list->size - list->count) * sizeof (SURVEY_FLAG);
+    }
+
+  list->flag[list->count].ping = s->ping;
+  list->flag[list->count].beam = s->beam;
+  list->flag[list->count].beams = s->beams;
+  list->count++;
+
+  if (flags->memory > flags->budget) flags_spill (flags, files);
+}
+
+
+
+/*  Pass 2, filter the tiles.  Returns the number of soundings filtered.  */
+
+static int64_t survey_filter (TILE_CACHE *cache, PIPELINE *pipeline, FLAG_CACHE *flags)
+{
+  int32_t             i, k, n, t, own, count, row, col, neighbor[9], neighbors, percent, old_percent;
+  int64_t             filtered;
+  double              lat0, lon0, sum_z, margin;
+  float               avg_z;
+  TILE_KEY            *key;
+  TILE                *tile;
+  SOUNDING            *s;
+  NV_F64_XYMBR        mbr;
+  GRID_LAYOUT         layout;
+  GRID                grid;
+  POINT_BUF           *points = &pipeline->points;
+  ARENA               *arena = &pipeline->arena;
+  FILTER_PARAMS       *params = &pipeline->params;
+
+
+  key = (TILE_KEY *) malloc (MAX (1, cache->tiles) * sizeof (TILE_KEY));
+  if (key == NULL)
+    {
+      perror ("Allocating tile order memory");
+      exit (-1);
+    }
+
+  for (t = 0 ; t < cache->tiles ; t++)
+    {
+      key[t].row = cache->tile[t].row;
+      key[t].col = cache->tile[t].col;
+      key[t].tile = t;
+    }
+
+  qsort (key, cache->tiles, sizeof (TILE_KEY), compare_tiles);
+
+
+  filtered = 0;
+  old_percent = -1;
+
+  for (n = 0 ; n < cache->tiles ; n++)
+    {
+      t = key[n].tile;
+      row = key[n].row;
+      col = key[n].col;
+
+
+      /*  Get the tile and its neighbors into memory and keep them there while we use them.  */
+
+      neighbors = 0;
+      neighbor[neighbors++] = t;
+      for (i = 0 ; i < 9 ; i++)
+        {
+          if (i == 4) continue;
+
+          k = tile_find (cache, row + i / 3 - 1, col + i % 3 - 1, NVFalse);
+          if (k >= 0) neighbor[neighbors++] = k;
+        }
+
+      for (i = 0 ; i < neighbors ; i++) cache->tile[neighbor[i]].pinned = NVTrue;
+      for (i = 0 ; i < neighbors ; i++) tile_load (cache, neighbor[i]);
+
+
+      /*  The tile's own soundings come first in the point buffer.  The cell size depends on their average depth
+          and we take the neighbors' soundings that are within the neighborhood radius (plus a cell) of the
+          tile's edges.  */
+
+      tile = &cache->tile[t];
+      lat0 = (double) row * cache->tile_deg;
+      lon0 = (double) col * cache->tile_deg;
+
+      arena_reset (arena);
+      mbr.min_x = mbr.min_y = 999.0;
+      mbr.max_x = mbr.max_y = -999.0;
+      sum_z = 0.0;
+
+      own = tile_points (tile, points, 0, 0.0, 0.0, 0.0, 0.0, -1.0, &mbr, &sum_z);
+      avg_z = (float) sum_z / (float) own;
+
+      grid_layout (&mbr, avg_z, NVFalse, &layout);
+      margin = MIN (cache->tile_deg, (double) (MAX (1, params->radius) + 1) * layout.cell_size);
+
+      count = own;
+      for (i = 1 ; i < neighbors ; i++)
+        count = tile_points (&cache->tile[neighbor[i]], points, count, lat0, lon0, lat0 + cache->tile_deg,
+                             lon0 + cache->tile_deg, margin, &mbr, &sum_z);
+
+      grid_layout (&mbr, avg_z, NVFalse, &layout);
+
+
+      grid_build (&grid, arena, points->lon, points->lat, points->dep, count, mbr.min_x, mbr.min_y,
+                  layout.cell_size, layout.height, layout.width, (params->pool != NULL && params->pool->threads));
+
+      grid_stats (&grid, arena, params);
+
+      gsf_filter (&grid, layout.dx, params);
+
+
+      /*  Only the tile's own soundings are flagged.  The neighbors' get flagged (or not) with their own tiles.  The
+          flagged ones are marked so that the tiles after this one leave them out.  */
+
+      for (k = 0 ; k < count ; k++)
+        {
+          i = grid.index[k];
+          if (!grid.filtered[k] || i >= own) continue;
+
+          s = &tile->data[i];
+          s->filtered = NVTrue;
+          tile->dirty = NVTrue;
+
+          flag_add (flags, pipeline->batch->files, s);
+
+          filtered++;
+        }
+
+
+      for (i = 0 ; i < neighbors ; i++) cache->tile[neighbor[i]].pinned = NVFalse;
+      cache_trim (cache);
+
+
+      percent = (int32_t) ((int64_t) (n + 1) * 100 / cache->tiles);
+      if (percent != old_percent)
+        {
+          printf ("%3d%% of tiles filtered    \r", percent);
+          fflush (stdout);
+          old_percent = percent;
+        }
+    }
+
+  if (cache->tiles) printf ("\n\n");
+
+  free (key);
+
+  return (filtered);
+}
+
+
+
+/*  Get the next flag of a run into its buffer.  Returns NVFalse if the run is finished.  */
+
+static uint8_t run_fill (FLAG_CACHE *flags, FLAG_RUN *run)
+{
+  if (run->next < run->count) return (NVTrue);
+
+  if (!run->left) return (NVFalse);
+
+  run->count = MIN (run->left, FLAG_BUFFER);
+  run->next = 0;
+
+  if (fseeko (flags->spill_fp, run->offset, SEEK_SET) ||
+      fread (run->flag, sizeof (SURVEY_FLAG), run->count, flags->spill_fp) != (size_t) run->count)
+    {
+      perror (flags->spill_name);
+      exit (-1);
+    }
+
+  run->offset += (int64_t) run->count * sizeof (SURVEY_FLAG);
+  run->left -= run->count;
+
+  return (NVTrue);
+}
+
+
+
+/*  The runs being merged are kept in a heap (heap[0] has the smallest next flag).  Move heap[i] down to where it
+    belongs.  */
+
+static void heap_down (FLAG_RUN *run, int32_t *heap, int32_t n, int32_t i)
+{
+  int32_t             c, swap;
+
+
+  while ((c = 2 * i + 1) < n)
+    {
+      if (c + 1 < n && compare_flags (&run[heap[c + 1]].flag[run[heap[c + 1]].next],
+                                      &run[heap[c]].flag[run[heap[c]].next]) < 0) c++;
+
+      if (compare_flags (&run[heap[c]].flag[run[heap[c]].next], &run[heap[i]].flag[run[heap[i]].next]) >= 0) break;
+
+      swap = heap[i];
+      heap[i] = heap[c];
+      heap[c] = swap;
+      i = c;
+    }
+}
+
+
+
+/*  Take the smallest flag off the runs.  Returns NVFalse when they're all finished.  */
+
+static uint8_t merge_next (FLAG_CACHE *flags, FLAG_RUN *run, int32_t *heap, int32_t *n, SURVEY_FLAG *flag)
+{
+  int32_t             r;
+
+
+  if (!*n) return (NVFalse);
+
+  r = heap[0];
+  *flag = run[r].flag[run[r].next++];
+
+  if (!run_fill (flags, &run[r])) heap[0] = heap[--(*n)];
+
+  heap_down (run, heap, *n, 0);
+
+  return (NVTrue);
+}
+
+
+
+/*  Pass 3, write the flags of each file to its sidecar and (unless --sidecar) apply them.  Each file's flags are
+    merged in order from its spilled runs and what's left in memory.  */
+
+static void survey_write (BATCH *batch, PIPELINE *pipeline, FLAG_CACHE *flags)
+{
+  int32_t             i, n, runs, ping_num, file_num, *heap;
+  uint8_t             more;
+  SURVEY_FLAGS        *list;
+  SURVEY_FLAG         flag;
+  FLAG_RUN            *run;
+  gsfSwathBathyPing   ping;
+  unsigned char       *beam_flags;
+
+
+  beam_flags = (unsigned char *) calloc (MAX_SIDECAR_BEAMS, sizeof (unsigned char));
+  if (beam_flags == NULL)
+    {
+      perror ("Allocating beam flag memory");
+      exit (-1);
+    }
+
+  memset (&ping, 0, sizeof (gsfSwathBathyPing));
+  ping.beam_flags = beam_flags;
+
+
+  /*  Start the progress over for applying the flags.  */
+
+  memset (batch->percent, 0, batch->files * sizeof (int32_t));
+  batch->done = 0;
+  batch->old_percent = -1;
+
+
+  for (file_num = 0 ; file_num < batch->files ; file_num++)
+    {
+      list = &flags->file[file_num];
+
+      qsort (list->flag, list->count, sizeof (SURVEY_FLAG), compare_flags);
+
+
+      /*  The flags still in memory are the last run.  */
+
+      runs = list->runs + 1;
+      run = (FLAG_RUN *) calloc (runs, sizeof (FLAG_RUN));
+      heap = (int32_t *) malloc (runs * sizeof (int32_t));
+      if (run == NULL || heap == NULL)
+        {
+          perror ("Allocating flag run memory");
+          exit (-1);
+        }
+
+      for (i = 0 ; i < list->runs ; i++)
+        {
+          run[i].flag = (SURVEY_FLAG *) malloc (FLAG_BUFFER * sizeof (SURVEY_FLAG));
+          if (run[i].flag == NULL)
+            {
+              perror ("Allocating flag run memory");
+              exit (-1);
+            }
+
+          run[i].offset = list->run_offset[i];
+          run[i].left = list->run_count[i];
+        }
+
+      run[list->runs].flag = list->flag;
+      run[list->runs].count = list->count;
+
+      n = 0;
+      for (i = 0 ; i < runs ; i++)
+        {
+          if (run_fill (flags, &run[i])) heap[n++] = i;
+        }
+
+      for (i = n / 2 - 1 ; i >= 0 ; i--) heap_down (run, heap, n, i);
+
+
+      pipeline->file = batch->file[file_num];
+      pipeline->file_num = file_num;
+
+      sidecar_open (pipeline);
+
+      more = merge_next (flags, run, heap, &n, &flag);
+
+      while (more)
+        {
+          ping_num = flag.ping;
+          ping.number_beams = flag.beams;
+          memset (beam_flags, 0, ping.number_beams);
+
+          do
+            {
+              beam_flags[flag.beam] = NV_GSF_IGNORE_FILTER_EDITED;
+              more = merge_next (flags, run, heap, &n, &flag);
+            } while (more && flag.ping == ping_num);
+
+          sidecar_ping (pipeline, &ping, ping_num);
+        }
+
+      sidecar_close (pipeline);
+
+      for (i = 0 ; i < list->runs ; i++) free (run[i].flag);
+      free (run);
+      free (heap);
+
+
+      if (pipeline->sidecar)
+        {
+          printf ("File : %s\n", pipeline->file);
+          fflush (stdout);
+
+          pthread_mutex_lock (&batch->mutex);
+          batch->done++;
+          pthread_mutex_unlock (&batch->mutex);
+
+          batch_progress (batch, file_num, 100);
+        }
+      else
+        {
+          sidecar_apply (batch, file_num);
+          sidecar_remove (pipeline->file);
+        }
+    }
+
+  free (beam_flags);
+}
+
+
+
+/*  Filter all of the files in the batch together (--survey).  */
+
+void run_survey (BATCH *batch)
+{
+  int32_t             i;
+  int64_t             filtered;
+  TILE_CACHE          cache;
+  PIPELINE            pipeline;
+  PAGE                *page;
+  FLAG_CACHE          flags;
+
+
+  memset (&cache, 0, sizeof (TILE_CACHE));
+  cache.tile_deg = batch->tile_size / 111120.0;
+  cache.budget = (batch->memory > 0.0 ? batch->memory : DEFAULT_TILE_CACHE * 1048576.0);
+  cache.budget = MAX (cache.budget, MIN_TILE_CACHE * 1048576.0);
+  cache.lru_head = cache.lru_tail = -1;
+  snprintf (cache.spill_name, sizeof (cache.spill_name), "%s/gsf_filter_tiles.%d.tmp",
+            batch->tile_dir != NULL ? batch->tile_dir : ".", (int32_t) getpid ());
+
+  memset (&flags, 0, sizeof (FLAG_CACHE));
+  flags.budget = cache.budget / (double) FLAG_SHARE;
+  cache.budget -= flags.budget;
+  snprintf (flags.spill_name, sizeof (flags.spill_name), "%s/gsf_filter_flags.%d.tmp",
+            batch->tile_dir != NULL ? batch->tile_dir : ".", (int32_t) getpid ());
+
+  flags.file = (SURVEY_FLAGS *) calloc (batch->files, sizeof (SURVEY_FLAGS));
+  if (flags.file == NULL)
+    {
+      perror ("Allocating flag memory");
+      exit (-1);
+    }
+
+
+  /*  The pipeline is only used for its reader and its point buffer and arena.  */
+
+  pipeline = batch->options;
+  pipeline.batch = batch;
+  pipeline.timing = NVFalse;
+  pipeline.write_hnd = -1;
+  pipeline.patch_fd = -1;
+
+  page = page_alloc (pipeline.page_size);
+
+
+  survey_read (batch, &cache, &pipeline, page);
+
+  printf ("%3d%% processed (%d of %d files read)    \n\n", batch->old_percent, batch->done, batch->files);
+
+  filtered = survey_filter (&cache, &pipeline, &flags);
+
+  printf ("Survey : %d tiles of %.0f meters\n", cache.tiles, batch->tile_size);
+  if (cache.spilled)
+    printf ("         %lld soundings written to %s, %lld read back\n", (long long) cache.spilled,
+            cache.spill_name, (long long) cache.reloaded);
+  printf ("         %lld soundings filtered\n", (long long) filtered);
+  if (flags.spilled)
+    printf ("         %lld flags written to %s\n", (long long) flags.spilled, flags.spill_name);
+  printf ("\n");
+
+  cache_free (&cache);
+
+  survey_write (batch, &pipeline, &flags);
+
+
+  for (i = 0 ; i < batch->files ; i++)
+    {
+      free (flags.file[i].flag);
+      free (flags.file[i].run_offset);
+      free (flags.file[i].run_count);
+    }
+  free (flags.file);
+
+  if (flags.spill_fp != NULL)
+    {
+      fclose (flags.spill_fp);
+      remove (flags.spill_name);
+    }
+
+  page_free (page, pipeline.page_size);
+  point_buf_free (&pipeline.points);
+  arena_free (&pipeline.arena);
+  free (pipeline.beam_lat);
+  free (pipeline.beam_lon);
+}
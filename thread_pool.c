@@ -0,0 +1,236 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+#include "gsf_filter.h"
+
+#ifdef NVWIN3X
+    #include <windows.h>
+#else
+    #include <unistd.h>
+#endif
+
+
+/*  Number of processors available to us.  */
+
+int32_t cpu_count ()
+{
+#ifdef NVWIN3X
+  SYSTEM_INFO info;
+
+  GetSystemInfo (&info);
+  return ((int32_t) info.dwNumberOfProcessors);
+#else
+  int32_t n = (int32_t) sysconf (_SC_NPROCESSORS_ONLN);
+
+  if (n < 1) n = 1;
+  return (n);
+#endif
+}
+
+
+
+/*  Take the next task from any batch that still has tasks left.  Must be called with the pool mutex held.  */
+
+static POOL_BATCH *next_task (THREAD_POOL *pool, int32_t *task)
+{
+  POOL_BATCH *batch;
+
+
+  for (batch = pool->batches ; batch != NULL ; batch = batch->link)
+    {
+      if (batch->next < batch->tasks)
+        {
+          *task = batch->next++;
+          return (batch);
+        }
+    }
+
+  return (NULL);
+}
+
+
+
+/*  Run one task and count it.  Called with the mutex held, returns with the mutex held.  */
+
+static void run_task (THREAD_POOL *pool, POOL_BATCH *batch, int32_t task)
+{
+  pthread_mutex_unlock (&pool->mutex);
+
+  (*batch->func) (batch->arg, task);
+
+  pthread_mutex_lock (&pool->mutex);
+
+  batch->done++;
+  if (batch->done == batch->tasks) pthread_cond_broadcast (&pool->finished);
+}
+
+
+
+static void *worker (void *arg)
+{
+  THREAD_POOL *pool = (THREAD_POOL *) arg;
+  POOL_BATCH *batch;
+  int32_t task;
+
+
+  pthread_mutex_lock (&pool->mutex);
+
+  while (NVTrue)
+    {
+      batch = next_task (pool, &task);
+
+      if (batch == NULL)
+        {
+          if (pool->shutdown) break;
+
+          pthread_cond_wait (&pool->work, &pool->mutex);
+          continue;
+        }
+
+      run_task (pool, batch, task);
+    }
+
+  pthread_mutex_unlock (&pool->mutex);
+
+  return (NULL);
+}
+
+
+
+/*  Create a pool for "threads" threads of execution.  The caller of thread_pool_run is one of them so we only
+    start threads - 1 workers.  Returns NULL (after saying why) if we couldn't get the memory or start the
+    threads.  */
+
+THREAD_POOL *thread_pool_create (int32_t threads)
+{
+  THREAD_POOL *pool;
+  int32_t i;
+
+
+  pool = (THREAD_POOL *) calloc (1, sizeof (THREAD_POOL));
+  if (pool == NULL)
+    {
+      perror ("Allocating thread pool memory");
+      return (NULL);
+    }
+
+  pthread_mutex_init (&pool->mutex, NULL);
+  pthread_cond_init (&pool->work, NULL);
+  pthread_cond_init (&pool->finished, NULL);
+
+  if (threads < 2) return (pool);
+
+
+  pool->thread = (pthread_t *) calloc (threads - 1, sizeof (pthread_t));
+  if (pool->thread == NULL)
+    {
+      perror ("Allocating thread memory");
+      thread_pool_destroy (pool);
+      return (NULL);
+    }
+
+  for (i = 0 ; i < threads - 1 ; i++)
+    {
+      if (pthread_create (&pool->thread[i], NULL, worker, pool))
+        {
+          perror ("Creating worker thread");
+          thread_pool_destroy (pool);
+          return (NULL);
+        }
+      pool->threads++;
+    }
+
+  return (pool);
+}
+
+
+
+void thread_pool_run (THREAD_POOL *pool, THREAD_TASK func, void *arg, int32_t tasks)
+{
+  POOL_BATCH batch, **prev;
+  int32_t task;
+
+
+  /*  Don't bother with the pool if there's nobody to share the work with.  */
+
+  if (pool == NULL || !pool->threads || tasks < 2)
+    {
+      for (task = 0 ; task < tasks ; task++) (*func) (arg, task);
+      return;
+    }
+
+
+  batch.func = func;
+  batch.arg = arg;
+  batch.tasks = tasks;
+  batch.next = 0;
+  batch.done = 0;
+
+
+  pthread_mutex_lock (&pool->mutex);
+
+  batch.link = pool->batches;
+  pool->batches = &batch;
+  pthread_cond_broadcast (&pool->work);
+
+
+  /*  Work on our own batch until it's all handed out, then wait for the stragglers.  */
+
+  while (batch.next < batch.tasks)
+    {
+      task = batch.next++;
+      run_task (pool, &batch, task);
+    }
+
+  while (batch.done < batch.tasks) pthread_cond_wait (&pool->finished, &pool->mutex);
+
+
+  for (prev = &pool->batches ; *prev != &batch ; prev = &(*prev)->link);
+  *prev = batch.link;
+
+  pthread_mutex_unlock (&pool->mutex);
+}
+
+
+
+void thread_pool_destroy (THREAD_POOL *pool)
+{
+  int32_t i;
+
+
+  if (pool == NULL) return;
+
+  pthread_mutex_lock (&pool->mutex);
+  pool->shutdown = NVTrue;
+  pthread_cond_broadcast (&pool->work);
+  pthread_mutex_unlock (&pool->mutex);
+
+  for (i = 0 ; i < pool->threads ; i++) pthread_join (pool->thread[i], NULL);
+
+  pthread_mutex_destroy (&pool->mutex);
+  pthread_cond_destroy (&pool->work);
+  pthread_cond_destroy (&pool->finished);
+
+  free (pool->thread);
+  free (pool);
+}
@@ -38,7 +38,7 @@
 
 #ifndef VERSION
 
-#define     VERSION     "PFM Software - gsf_filter V1.06 - 07/23/14"
+#define     VERSION     "PFM Software - gsf_filter V1.31 - 10/17/26"
 
 #endif
 
@@ -93,4 +93,246 @@
     - Switched from using the old NV_INT64 and NV_U_INT32 type definitions to the C99 standard stdint.h and
       inttypes.h sized data types (e.g. int64_t and uint32_t).
 
+
+    Version 1.07
+    PFM Software
+    10/17/26
+
+    - Keep a copy of each ping record that contributes points to a page so that the filter flags can be set and
+      written back without reading (and decoding) the ping a second time.
+    - Fixed infinite loop when a page was closed due to a position jump of more than 1000 meters.
+    - Fixed stale flush of the last modified ping of the previous page.
+
+
+    Version 1.08
+    PFM Software
+    10/17/26
+
+    - Replaced the five per-beam realloc calls with a structure of arrays point buffer that doubles in size and is
+      kept for the whole run.
+    - Added a page memory arena (arena.c) that backs the grid and the per-cell depth lists.  The arena is reset
+      between pages so that, in the steady state, a page does no malloc or free at all.
+
+
+    Version 1.09
+    PFM Software
+    10/17/26
+
+    - Replaced the per-cell realloc of the depth lists with a counting sort.  Points are counted per cell, the counts
+      are turned into offsets, and the point indices are scattered into one contiguous depth array.  Each grid cell
+      now refers to its own slice of that array.
+
+
+    Version 1.10
+    PFM Software
+    10/17/26
+
+    - Replaced the row pointer array of GRID_REC structures with a single structure of arrays grid (GRID).  The
+      averages, standard deviations, counts, and depth slice offsets are separate flat arrays and the cleared flags
+      are a bitmap.  The neighbor reads in gsf_filter only touch the arrays they need.
+
+
+    Version 1.11
+    PFM Software
+    10/17/26
+
+    - Added --threads option.  The filter is run as a wavefront of tiles on a thread pool (thread_pool.c).  The
+      tiles are cut in row by (row + column) space so that every cell still sees exactly the same neighbor
+      statistics that it sees in the serial raster sweep.  The filtered flags are bit for bit the same for any
+      number of threads.  Defaults to the number of processors.
+
+
+    Version 1.12
+    PFM Software
+    10/17/26
+
+    - Added --jacobi option.  Every cell is filtered against a snapshot of its neighbors' statistics taken before
+      the sweep and writes its updated statistics to the live grid, so all cells are independent.  The bands of rows
+      are run on the thread pool and the neighborhood sums are built with branch free loops that vectorize.
+    - Added --jacobi_check option that also runs the normal filter on each page and reports how many flags differ.
+
+
+    Version 1.13
+    PFM Software
+    10/17/26
+
+    - Per-cell depths are now stored contiguously so the per-cell sums, the
+      sigma test and the recompute run through SSE4.2, AVX2 or AVX-512 kernels
+      selected at run time (scalar fallback).  Added --isa to force a kernel set.
+    - All kernel sets accumulate in the same fixed 8-lane order so the results
+      do not depend on the CPU.
+
+
+    Version 1.14
+    PFM Software
+    10/17/26
+
+    - Split the page loop into read, filter, and write stages.  By default the
+      reader and writer run in their own threads (with their own GSF handles)
+      connected to the filter by bounded page queues so the I/O overlaps the
+      filtering.  Added --pipeline to set the queue depth (0 runs the stages in
+      sequence).  Results are the same either way.
+
+
+    Version 1.15
+    PFM Software
+    10/17/26
+
+    - Added batch mode.  Any number of GSF files (or wildcard patterns) may be
+      given on the command line or in a --list file.  --jobs sets how many files
+      are filtered at the same time (sharing the filter threads) and --memory
+      sets a memory budget that holds files back until they fit.  Progress is
+      reported for the whole batch and every file gets its own history record.
+
+
+    Version 1.16
+    PFM Software
+    10/17/26
+
+    - Added --fast_georef to position the beams with a second order local
+      tangent plane expansion built once per ping instead of two newgp calls per
+      beam.  Added --georef_check to also run newgp and report the largest
+      difference.  The error bound is documented in georef.c.
+
+
+    Version 1.17
+    PFM Software
+    10/17/26
+
+    - Added --halo to grid the last and first pings of the neighboring pages
+      along with each page so the cells at the ends of a page have all of their
+      neighbors.  Halo points are used for the statistics but only flagged when
+      their own page is filtered.  Pings are still only read and decoded once.
+
+
+    Version 1.18
+    PFM Software
+    10/17/26
+
+    - Replaced the dense page grid with a sparse grid that only stores the cells
+      that have points in them (found with a hash table and kept in raster
+      order).  The grid no longer has to be coarsened when the page covers a
+      large area (a turn or a bad position) so the cell size is always the one
+      computed from the depth.  Results are unchanged for pages that didn't need
+      coarsening.
+
+
+    Version 1.19
+    PFM Software
+    10/17/26
+
+    - Added --rotate to grid each page in a frame rotated to the mean heading of its pings so the cells line up
+      with the swath on diagonal survey lines.
+
+
+    Version 1.20
+    PFM Software
+    10/17/26
+
+    - Added bench/gsf_filter_bench, which generates a reproducible synthetic GSF file and reports the time
+      spent in each stage of the filter as pings and soundings per second.
+
+
+    Version 1.21
+    PFM Software
+    10/17/26
+
+    - Added --profile to write a JSON line for every page with its ping, sounding, grid, filtered, and
+      rewritten ping counts and the time spent in each stage.
+
+
+    Version 1.22
+    PFM Software
+    10/17/26
+
+    - Added --sidecar to write the filter flags to FILE.flg instead of changing the GSF file, and --apply to
+      set the flags from the sidecar files in one sequential pass.
+
+
+    Version 1.23
+    PFM Software
+    10/17/26
+
+    - Added checkpoints (FILE.ckp, written before each page is written and removed when the file is done)
+      and --resume to pick up a stopped file from its last checkpoint with the same results as an
+      uninterrupted run.
+
+
+    Version 1.24
+    PFM Software
+    10/17/26
+
+    - Added the gsf_filter_engine library (gsf_filter_engine.h, engine/gsf_filter_engine.pro) so that other
+      programs can push batches of points through the filter in process and get back a bit set of the
+      filtered points.
+
+
+    Version 1.25
+    PFM Software
+    10/17/26
+
+    - Split the per cell threshold test into deep only and two sided versions that are picked once per run
+      instead of testing deep for every sounding.
+    - Added --precision float, an exact single precision threshold test that is two to four times faster on
+      dense cells.  Added --check to gsf_filter_bench to compare every kernel with the original loop.
+
+
+    Version 1.26
+    PFM Software
+    10/17/26
+
+    - Added --passes to keep filtering the cells around the ones that changed until nothing changes (or
+      PASSES passes have been made).  The passes and cells filtered again are reported per file and in the
+      --profile output.
+
+
+    Version 1.27
+    PFM Software
+    10/17/26
+
+    - Added --radius for neighborhoods wider than 3 by 3 (5 by 5 for 2, 7 by 7 for 3, ...).  The
+      neighborhood sums come from running sums along the rows of occupied cells (window.c) so each cell
+      costs about 2 * RADIUS + 1 lookups per pass instead of the (2 * RADIUS + 1) squared of adding up
+      the whole neighborhood.
+
+
+    Version 1.28
+    PFM Software
+    10/17/26
+
+    - Added --fast_read.  With --sidecar the pings are read through a memory map and only the position, heading, ping
+      flags, and the depth, nominal depth, across track, along track, and beam flag arrays are decoded, straight into
+      the page (see gsf_map.c).  Anything it can't decode goes back to gsfRead for the rest of the file.
+    - Added --fast_read_check to compare every ping read through the map with gsfRead.
+    - Added --sidecar and --fast_read to the benchmark.
+
+
+    Version 1.29
+    PFM Software
+    10/17/26
+
+    - --fast_read now works without --sidecar.  The reader remembers where each ping's beam flags are in the file and
+      the writer overwrites just the bytes from the first to the last beam it flagged instead of rewriting the whole
+      ping with gsfWrite.  Pings read with gsfRead (and records with checksums) still go through gsfWrite.  The history
+      record is added at the end the same as before.
+
+
+    Version 1.30
+    PFM Software
+    10/17/26
+
+    - --fast_read no longer opens the file with the GSF library (which builds the index file if there isn't one) before
+      it starts.  The pings are read in order through the memory map and the flags are patched in place so the GSF
+      handle is only opened if a ping has to be written with gsfWrite or a checkpoint has to be replayed.
+
+
+    Version 1.31
+    PFM Software
+    10/17/26
+
+    - Added --survey to filter all of the files together in square tiles (--tile_size meters) so that overlapping
+      lines are filtered against each other.  The tiles are held in a cache bounded by --memory, with the least
+      recently used ones spilled to a temporary file in --tile_dir, and the flags go back to the files through the
+      sidecar files.
+
 */
@@ -0,0 +1,198 @@
+
+/*********************************************************************************************
+
+    This is public domain software that was developed by or for the U.S. Naval Oceanographic
+    Office and/or the U.S. Army Corps of Engineers.
+
+    This is a work of the U.S. Government. In accordance with 17 USC 105, copyright protection
+    is not available for any work of the U.S. Government.
+
+    Neither the United States Government, nor any employees of the United States Government,
+    nor the author, makes any warranty, express or implied, without even the implied warranty
+    of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE, or assumes any liability or
+    responsibility for the accuracy, completeness, or usefulness of any information,
+    apparatus, product, or process disclosed, or represents that its use would not infringe
+    privately-owned rights. Reference herein to any specific commercial products, process,
+    or service by trade name, trademark, manufacturer, or otherwise, does not necessarily
+    constitute or imply its endorsement, recommendation, or favoring by the United States
+    Government. The views and opinions of authors expressed herein do not necessarily state
+    or reflect those of the United States Government, and shall not be used for advertising
+    or product endorsement purposes.
+
+*********************************************************************************************/
+
+#include "gsf_filter.h"
+
+
+/*  Window sums for neighborhoods of radius cells around each cell (2 * radius + 1 cells on a side).  Adding up the
+    window for every cell would cost radius squared per cell and sliding the window over the whole grid would cost
+    the height times the width of the grid, which can be huge for a page with a bad position in it (see grid.c).
+    So we only ever look at the cells that are there.  For each row with cells in it we take running sums across
+    the row's cells (which are in column order).  A cell's window is then, for each of the rows with cells within
+    radius rows of it, the difference of two of those running sums, found by stepping through the row's cells as
+    we go across the cell's own row.  The cost is about 2 * radius + 1 lookups per cell, so it still goes up with
+    the radius (linearly instead of with its square), and the sums are built again for every pass.  A summed area
+    table would make it the same for any radius but it would have to cover the whole height times width of the
+    grid.  This way the memory depends only on the number of cells.
+
+    The sums are taken from the snapshot (snap_avg, snap_std, snap_active) so the cells see their neighborhoods as
+    they were before the pass, like the Jacobi filter.  The averages have ref (the mean of the active averages)
+    taken off before they're added up.  Otherwise the squared averages of deep water cells would be so big that
+    taking one running sum away from another would lose the differences we're looking for.  The running sums
+    start over at each row for the same reason.  */
+
+#define CHANNELS        6
+
+
+/*  Make room for the window sums (from the page arena).  There are at most as many rows as cells, and each row's
+    running sums take one more entry than it has cells.  */
+
+void window_alloc (GRID *grid, ARENA *arena, int32_t radius)
+{
+  WINDOW *window = &grid->window;
+
+
+  window->radius = radius;
+  window->rows = (int32_t *) arena_alloc (arena, (grid->cells + 1) * sizeof (int32_t));
+  window->row_start = (int32_t *) arena_alloc (arena, (grid->cells + 1) * sizeof (int32_t));
+  window->lo = (int32_t *) arena_alloc (arena, (2 * radius + 1) * sizeof (int32_t));
+  window->hi = (int32_t *) arena_alloc (arena, (2 * radius + 1) * sizeof (int32_t));
+  window->prefix = (double *) arena_alloc (arena, CHANNELS * (2 * grid->cells + 1) * sizeof (double));
+  window->count = (int32_t *) arena_alloc (arena, grid->cells * sizeof (int32_t));
+  window->changed = (int32_t *) arena_alloc (arena, grid->cells * sizeof (int32_t));
+  window->sum = (double *) arena_alloc (arena, grid->cells * sizeof (double));
+  window->sum_std = (double *) arena_alloc (arena, grid->cells * sizeof (double));
+  window->sum2 = (double *) arena_alloc (arena, grid->cells * sizeof (double));
+}
+
+
+
+/*  Fill in the window sums for every cell from the snapshot (and, if we're making more than one pass, count the
+    cells in each window that changed in the last pass).  Only the active cells count in the statistics but any
+    cell that changed (even if it was cleared) counts as changed.  */
+
+void window_sums (GRID *grid)
+{
+  WINDOW *window = &grid->window;
+  int32_t c, b, e, i, j, k, k0, k1, ch, base, end, rows, active, r = window->radius, stride = 2 * grid->cells + 1;
+  double a, value[CHANNELS], total[CHANNELS], *p;
+
+
+  /*  The cells are in raster order so each row's cells are contiguous.  */
+
+  rows = 0;
+  for (c = 0 ; c < grid->cells ; c++)
+    {
+      if (!c || grid->row[c] != grid->row[c - 1])
+        {
+          window->rows[rows] = grid->row[c];
+          window->row_start[rows] = c;
+          rows++;
+        }
+    }
+  window->row_start[rows] = grid->cells;
+
+
+  window->ref = 0.0;
+  active = 0;
+  for (c = 0 ; c < grid->cells ; c++)
+    {
+      if (grid->snap_active[c])
+        {
+          window->ref += grid->snap_avg[c];
+          active++;
+        }
+    }
+  if (active) window->ref /= (double) active;
+
+
+  /*  Running sums across each row.  Row j's start at prefix[row_start[j] + j] so that entry i of the row is the sum
+      of the row's first i cells.  */
+
+  for (j = 0 ; j < rows ; j++)
+    {
+      base = window->row_start[j] + j;
+
+      for (ch = 0 ; ch < CHANNELS ; ch++) window->prefix[ch * stride + base] = 0.0;
+
+      for (c = window->row_start[j] ; c < window->row_start[j + 1] ; c++)
+        {
+          for (ch = 0 ; ch < CHANNELS ; ch++) value[ch] = 0.0;
+
+          if (grid->changed != NULL && grid->changed[c]) value[4] = 1.0;
+
+          if (grid->snap_active[c])
+            {
+              a = (double) grid->snap_avg[c] - window->ref;
+
+              value[0] = 1.0;
+              value[1] = a;
+              value[3] = a * a;
+
+
+              /*  A cell whose depths are all the same can have a NaN standard deviation (see grid_stats).  In
+                  the 3 by 3 neighborhood that makes the sum NaN for just the neighbors of the cell so we count
+                  them instead of letting the NaN into the running sums, where it would spoil every window after
+                  it.  */
+
+              if (isnan (grid->snap_std[c]))
+                {
+                  value[5] = 1.0;
+                }
+              else
+                {
+                  value[2] = (double) grid->snap_std[c];
+                }
+            }
+
+          i = base + c - window->row_start[j];
+          for (ch = 0 ; ch < CHANNELS ; ch++)
+            window->prefix[ch * stride + i + 1] = window->prefix[ch * stride + i] + value[ch];
+        }
+    }
+
+
+  for (j = 0 ; j < rows ; j++)
+    {
+      /*  The rows with cells that are within r rows of this one.  */
+
+      for (k0 = j ; k0 > 0 && window->rows[k0 - 1] >= window->rows[j] - r ; k0--);
+      for (k1 = j ; k1 < rows - 1 && window->rows[k1 + 1] <= window->rows[j] + r ; k1++);
+
+      for (k = k0 ; k <= k1 ; k++) window->lo[k - k0] = window->hi[k - k0] = window->row_start[k];
+
+
+      /*  Going across the row the first and last cells of each of those rows that are within r columns only ever
+          move to the right.  */
+
+      for (c = window->row_start[j] ; c < window->row_start[j + 1] ; c++)
+        {
+          for (ch = 0 ; ch < CHANNELS ; ch++) total[ch] = 0.0;
+
+          for (k = k0 ; k <= k1 ; k++)
+            {
+              i = k - k0;
+              end = window->row_start[k + 1];
+
+              while (window->lo[i] < end && grid->col[window->lo[i]] < grid->col[c] - r) window->lo[i]++;
+              while (window->hi[i] < end && grid->col[window->hi[i]] <= grid->col[c] + r) window->hi[i]++;
+
+              base = window->row_start[k] + k;
+              b = window->lo[i] - window->row_start[k];
+              e = window->hi[i] - window->row_start[k];
+
+              for (ch = 0 ; ch < CHANNELS ; ch++)
+                {
+                  p = &window->prefix[ch * stride + base];
+                  total[ch] += p[e] - p[b];
+                }
+            }
+
+          window->count[c] = NINT (total[0]);
+          window->sum[c] = total[1];
+          window->sum_std[c] = total[5] > 0.5 ? (double) NAN : total[2];
+          window->sum2[c] = total[3];
+          window->changed[c] = NINT (total[4]);
+        }
+    }
+}